@@ -1,3 +1,7 @@
+#ifdef __linux__
+#define _GNU_SOURCE	// pthread_setaffinity_np
+#endif
+
 /*
  * p1bench - perturbation benchmark. Tests simple CPU or memory loops.
  *
@@ -27,22 +31,133 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <elf.h>
+#include <link.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 void usage()
 {
-	printf("USAGE: p1bench [-hv] [-m Mbytes] [time(ms) [count]]\n"
+	printf("USAGE: p1bench [-EhHIlOpRSTvVx] [-m size] [-w type] [-P threads]\n"
+	    "                [-D pct] [-e conf] [-C ways] [-f file [-A advice]]\n"
+	    "                [-n proto] [-i type] [-s bytes] [-c cpu[,cpu]]\n"
+	    "                [-u file [-q depth] [-U opts]] [-g file.svg]\n"
+	    "                [-b file] [-K events] [-L prefix] [-z pct]\n"
+	    "                [time(ms) [count]]\n"
+	    "       p1bench -r [-aHv] [-g file.svg] [-t from,to] [-G key] file ...\n"
 	    "                   -v         # verbose: per run details\n"
-	    "                   -m Mbytes  # memory test working set\n"
+	    "                   -H         # print a heatmap over time (ANSI)\n"
+	    "                   -g file    # write a heatmap over time as SVG\n"
+	    "                   -O         # measure instrumentation overhead\n"
+	    "                   -b file    # append results to a binary file,\n"
+	    "                              #   count 0 runs until Ctrl-C\n"
+	    "                   -r         # report from -b result files\n"
+	    "                   -t from,to # -r range: epoch secs, negative\n"
+	    "                              #   for secs ago, either may be empty\n"
+	    "                   -G key     # -r breakdown by host, cpu, kernel,\n"
+	    "                              #   product, mode, ... (-v: reports)\n"
+	    "                   -a         # -r percents vs fastest of all hosts,\n"
+	    "                              #   not each host's own fastest\n"
+	    "                   -e conf    # repetitions needed to detect 0.5,\n"
+	    "                              #   1, 2, 5%% slowdowns at conf%%\n"
+	    "                   -p         # pre-flight host configuration checks\n"
+	    "                   -I         # validate isolated CPUs (or -c cpu)\n"
+	    "                   -K events  # explain slow runs with tracefs:\n"
+	    "                              #   default, or sys:event,... (-c)\n"
+	    "                   -L prefix  # sample stacks: prefix.slow.folded,\n"
+	    "                              #   prefix.fast.folded flame graphs\n"
+	    "                   -V         # vmstat reclaim, compaction, NUMA\n"
+	    "                              #   and fault deltas vs run time\n"
+	    "                   -E         # RAPL package and DRAM energy and\n"
+	    "                              #   power vs run time\n"
+	    "                   -z pct     # snapshot competing tasks for runs\n"
+	    "                              #   over pct slower than fastest\n"
+	    "                   -T         # fixed-time runs: measure iterations\n"
+	    "                   -m size    # memory test working set: Mbytes,\n"
+	    "                              #   or with K, M, G, T suffix\n"
+	    "                   -x         # interleave runs of a matrix: lists\n"
+	    "                              #   of time(ms), -m, -w\n"
+	    "                   -D pct     # sweep durations up to time(ms),\n"
+	    "                              #   find shortest within pct\n"
+	    "                   -w type    # memory access type: read (default),\n"
+	    "                              #   write, rmw, stream, chase\n"
+	    "                   -l         # for chase: sampled per-load latency\n"
+	    "                   -P threads # parallel memory test threads\n"
+	    "                   -S         # threads share one working set\n"
+	    "                   -R         # resctrl LLC and bandwidth monitoring\n"
+	    "                   -C ways    # alternate runs in a CAT partition\n"
+	    "                   -f file    # mmap file as memory working set\n"
+	    "                   -A advice  # for -f: populate, random (no\n"
+	    "                              #   readahead), or sequential\n"
+	    "                   -n proto   # loopback round trips: tcp, udp, unix\n"
+	    "                   -i type    # IPC to a peer thread: pipe, splice,\n"
+	    "                              #   eventfd (round trips)\n"
+	    "                   -s bytes   # message or I/O size (default 64,\n"
+	    "                              #   4096 for -u)\n"
+	    "                   -c cpu[,cpu] # pin benchmark[,server] thread\n"
+	    "                   -u file    # io_uring random reads of a file\n"
+	    "                   -q depth   # io_uring queue depth (default 8)\n"
+	    "                   -U opts    # io_uring: poll, iopoll, fixed,\n"
+	    "                              #   direct\n"
 	    "   eg,\n"
 	    "       p1bench          # 100ms (default) CPU spin loop\n"
 	    "       p1bench 300      # 300ms CPU spin loop\n"
 	    "       p1bench 300 100  # 300ms CPU spin loop, 100 times\n"
-	    "       p1bench -m 1024  # 1GB memory read loop\n");
+	    "       p1bench -H 10 6000      # 10ms runs for 1 min, heatmap\n"
+	    "       p1bench -K default -c 3 # trace slow runs on CPU 3\n"
+	    "       p1bench -z 5 -c 3       # snapshot runs over 5%% slower\n"
+	    "       p1bench -L out 10 1000  # slow vs fast run stacks\n"
+	    "       p1bench -E 1000 60      # energy per run, power capping\n"
+	    "       p1bench -m 0,64,1024 -x 1,10,100 # matrix, interleaved\n"
+	    "       p1bench -D 1 1000 20    # run length needed for 1%%\n"
+	    "       p1bench -b hist.p1b 100 0   # record until Ctrl-C\n"
+	    "       p1bench -r -t -86400, hist.p1b # report the last day\n"
+	    "       p1bench -r -G cpu *.p1b # merge hosts, by CPU model\n"
+	    "       p1bench -m 1024  # 1GB memory read loop\n"
+	    "       p1bench -m 1024 -w rmw  # 1GB memory read-modify-write loop\n"
+	    "       p1bench -m 2T -w chase  # 2TB load latency\n"
+	    "       p1bench -m 65536 -V     # 64GB, with memory management events\n"
+	    "       p1bench -m 1024 -w chase -l # 1GB load latency histogram\n"
+	    "       p1bench -m 256 -P 8     # 8 threads, 256MB each\n"
+	    "       p1bench -m 64 -C 4      # 64MB, 4-way L3 partition vs not\n"
+	    "       p1bench -f data.db      # page cache read loop over a file\n"
+	    "       p1bench -n tcp -c 0,1   # TCP loopback, pinned to CPUs 0,1\n"
+	    "       p1bench -i pipe -s 4096 # 4KB pipe writes\n"
+	    "       p1bench -u data.db -q 32 -U fixed # io_uring, QD 32\n");
 }
 
 /*
@@ -80,7 +195,6 @@ void *memtest(void *arg)
 {
 	unsigned long long *count = (unsigned long long *)arg;
 	char *memp;
-	unsigned long long i, j;
 	int junk;
 
 	signal(SIGUSR1, teststop);
@@ -88,7 +202,7 @@ void *memtest(void *arg)
 	for (;g_testrun;) {
 		junk += memp[0];
 		memp += g_stride;
-		if (memp > (g_mem + g_memsize))
+		if (memp >= (g_mem + g_memsize))
 			memp = g_mem;
 		(*count)++;
 	}
@@ -96,228 +210,5587 @@ void *memtest(void *arg)
 	return NULL;
 }
 
-unsigned long long memrun(unsigned long long count)
+/*
+ * The memory run functions walk a given region, so that they can be used
+ * on g_mem directly or on a per-thread slice of it (-P).
+ */
+unsigned long long memread(char *mem, unsigned long long size,
+    unsigned long long count)
 {
 	char *memp;
-	unsigned long long i, j;
+	unsigned long long i;
 	int junk;
 
+	memp = mem;
+	for (i = 0; i < count; i++) {
+		junk += memp[0];
+		memp += g_stride;
+		if (memp >= (mem + size))
+			memp = mem;
+	}
+	return i;
+}
+
+void *memwtest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+	char *memp;
+
 	signal(SIGUSR1, teststop);
 	memp = g_mem;
+	for (;g_testrun;) {
+		memp[0] = (char)*count;
+		memp += g_stride;
+		if (memp >= (g_mem + g_memsize))
+			memp = g_mem;
+		(*count)++;
+	}
+
+	return NULL;
+}
+
+unsigned long long memwrite(char *mem, unsigned long long size,
+    unsigned long long count)
+{
+	char *memp;
+	unsigned long long i;
+
+	memp = mem;
 	for (i = 0; i < count; i++) {
-		junk += memp[0];
+		memp[0] = (char)i;
+		memp += g_stride;
+		if (memp >= (mem + size))
+			memp = mem;
+	}
+	return i;
+}
+
+void *memrmwtest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+	char *memp;
+
+	signal(SIGUSR1, teststop);
+	memp = g_mem;
+	for (;g_testrun;) {
+		memp[0]++;
 		memp += g_stride;
-		if (memp > (g_mem + g_memsize))
+		if (memp >= (g_mem + g_memsize))
 			memp = g_mem;
+		(*count)++;
+	}
+
+	return NULL;
+}
+
+unsigned long long memrmw(char *mem, unsigned long long size,
+    unsigned long long count)
+{
+	char *memp;
+	unsigned long long i;
+
+	memp = mem;
+	for (i = 0; i < count; i++) {
+		memp[0]++;
+		memp += g_stride;
+		if (memp >= (mem + size))
+			memp = mem;
 	}
 	return i;
 }
 
 /*
- * Runs the loop function for the target_us while incrementing count.
- * This gives us a ballpark figure of the target count.
+ * Streaming (non-temporal) stores bypass the cache hierarchy on x86, so
+ * write-back and dirty-line eviction costs move to the memory controller.
+ * Elsewhere these fall back to ordinary stores.
  */
-void test_run(unsigned long long target_us, unsigned long long *count,
-    void *(*loop)(void *))
+#ifdef __SSE2__
+#define STREAM_STORE(p, v)	_mm_stream_si32((int *)(p), (int)(v))
+#define STREAM_FENCE()		_mm_sfence()
+#else
+#define STREAM_STORE(p, v)	(*(int *)(p) = (int)(v))
+#define STREAM_FENCE()
+#endif
+
+void *memstest(void *arg)
 {
-	pthread_t thread;
-	int err;
+	unsigned long long *count = (unsigned long long *)arg;
+	char *memp;
 
-	if (!target_us)
-		return;
+	signal(SIGUSR1, teststop);
+	memp = g_mem;
+	for (;g_testrun;) {
+		STREAM_STORE(memp, *count);
+		memp += g_stride;
+		if (memp >= (g_mem + g_memsize))
+			memp = g_mem;
+		(*count)++;
+	}
+	STREAM_FENCE();
 
-	g_testrun = 1;
-	(*count) = 0;
-	if (pthread_create(&thread, NULL, loop, count) != 0) {
-		perror("Thread create failed");
-		exit(1);
+	return NULL;
+}
+
+unsigned long long memstream(char *mem, unsigned long long size,
+    unsigned long long count)
+{
+	char *memp;
+	unsigned long long i;
+
+	memp = mem;
+	for (i = 0; i < count; i++) {
+		STREAM_STORE(memp, i);
+		memp += g_stride;
+		if (memp >= (mem + size))
+			memp = mem;
 	}
-	usleep(target_us);
-	if ((err = pthread_kill(thread, SIGUSR1))) {
-		perror("Couldn't terminate worker thread normally");
-		exit(1);
+	STREAM_FENCE();
+	return i;
+}
+
+// pointer chasing, with the latency histograms below
+void *chasetest(void *arg);
+unsigned long long memchase(char *mem, unsigned long long size,
+    unsigned long long count);
+void chase_init(char *mem, unsigned long long size);
+
+// memory access types for -w. init, if set, prepares a working set.
+struct memtype {
+	const char *name;
+	const char *desc;
+	void *(*test)(void *);
+	unsigned long long (*run)(char *, unsigned long long,
+	    unsigned long long);
+	void (*init)(char *, unsigned long long);
+} g_memtypes[] = {
+	{ "read",   "read loop",              memtest,    memread,   NULL },
+	{ "write",  "write loop",             memwtest,   memwrite,  NULL },
+	{ "rmw",    "read-modify-write loop", memrmwtest, memrmw,    NULL },
+	{ "stream", "streaming store loop",   memstest,   memstream, NULL },
+	{ "chase",  "pointer chasing loop",   chasetest,  memchase,
+	    chase_init },
+	{ NULL }
+};
+struct memtype *g_memtype = &g_memtypes[0];
+
+struct memtype *find_memtype(const char *name)
+{
+	struct memtype *mt;
+
+	for (mt = g_memtypes; mt->name; mt++) {
+		if (strcmp(mt->name, name) == 0)
+			return mt;
 	}
-	pthread_join(thread, NULL);
+	return NULL;
+}
+
+unsigned long long memrun(unsigned long long count)
+{
+	return g_memtype->run(g_mem, g_memsize, count);
+}
+
+static unsigned long long elapsed_us(struct timeval *ts)
+{
+	return 1000000 * (ts[1].tv_sec - ts[0].tv_sec) +
+	    (ts[1].tv_usec - ts[0].tv_usec);
 }
 
 /*
- * Finds a ballpark target count, then runs the real run function with that
- * count several times (test_runs) to fine tune the target count.
+ * Runs count strides of the memory loop over mem, starting pos strides in
+ * and wrapping around to the start of mem.
  */
-unsigned long long find_count(unsigned long long target_us,
-    int test_us, int test_runs,
-    void *(*test)(void *),
-    unsigned long long (*run)(unsigned long long))
+static void memrun_at(char *mem, unsigned long long size,
+    unsigned long long pos, unsigned long long count)
 {
-	unsigned long long time_us;
-	unsigned long long fastest_time_us = ~0ULL;
-	unsigned long long iter_count = 0;
-	static struct timeval ts[2];
-	int i;
+	unsigned long long steps, first;
 
-	test_run(test_us, &iter_count, test);
-	for (i = 0; i < test_runs; i++) {
-		gettimeofday(&ts[0], NULL);
-		(void) run(iter_count);
-		gettimeofday(&ts[1], NULL);
-		time_us = 1000000 * (ts[1].tv_sec - ts[0].tv_sec) +
-		    (ts[1].tv_usec - ts[0].tv_usec) / 1;
-		if (time_us < fastest_time_us)
-			fastest_time_us = time_us;
-	}
-	return iter_count * target_us / fastest_time_us;
+	steps = (size + g_stride - 1) / g_stride;
+	first = steps - pos < count ? steps - pos : count;
+	(void) g_memtype->run(mem + pos * g_stride, size - pos * g_stride,
+	    first);
+	if (count > first)
+		(void) g_memtype->run(mem, size, count - first);
 }
 
 /*
- * Value to histogram index.
- * This is a custom histogram with the following ranges:
- *     value 0-1: 0.1 step size, idx 0-9
- *     value 1-20: 1 step size, idx 10-28
- *     value 20+: 10 step size, idx 19+
+ * Parallel memory test (-P): each thread runs the memory loop over its own
+ * slice of g_mem (or all of it, if shared), timing itself.
  */
-static int hist_idx(double value, int buckets)
-{
-	int idx;
+struct memthread {
+	pthread_t thread;
+	char *mem;
+	unsigned long long size;
+	unsigned long long start;	// in strides, where the loop begins
+	unsigned long long count;
+	unsigned long long time_us;
+	unsigned long long total_us;	// sum of time_us across runs
+};
+struct memthread *g_memthreads;
+int g_nthreads = 1;
 
-	if (value < 1)
-		idx = (int)(10 * value);
-	else if (value < 20)
-		// idx = previous_steps + (value - min_range_value)
-		idx = 10 + (int)(value - 1);
-	else
-		// idx = previous_steps + (value - min_range_value)/10
-		idx = 29 + (int)((value - 20) / 10);
+void *memparthread(void *arg)
+{
+	struct memthread *mt = (struct memthread *)arg;
+	struct timeval ts[2];
 
-	if (idx > buckets - 1)
-		idx = buckets - 1;
-	return idx;
+	gettimeofday(&ts[0], NULL);
+	memrun_at(mt->mem, mt->size, mt->start, mt->count);
+	gettimeofday(&ts[1], NULL);
+	mt->time_us = elapsed_us(ts);
+	return NULL;
 }
 
-// histogram index to minimum value
-double hist_val(int idx)
+unsigned long long memparrun(unsigned long long count)
 {
-	if (idx < 10)
-		return (double)idx / 10;
-	else if (idx < 29)
-		// 10 -> 1.0
-		// 11 -> 2
-		// value = idx - previous_steps + min_range_value
-		return (double)idx - 10 + 1;
-	else
-		// value = (idx - previous_steps) * 10 + min_range_value
-		return (double)(idx - 29) * 10 + 20;
+	int i;
+
+	for (i = 0; i < g_nthreads; i++) {
+		g_memthreads[i].count = count;
+		if (pthread_create(&g_memthreads[i].thread, NULL,
+		    memparthread, &g_memthreads[i]) != 0) {
+			perror("Thread create failed");
+			exit(1);
+		}
+	}
+	for (i = 0; i < g_nthreads; i++)
+		pthread_join(g_memthreads[i].thread, NULL);
+	return count;
 }
 
-static int ullcmp(const void *p1, const void *p2)
+/*
+ * CPU pinning (-c). Returns -1 where unsupported.
+ */
+int pin_cpu(pthread_t thread, int cpu)
 {
-	unsigned long long a = *(unsigned long long *)p1;
-	unsigned long long b = *(unsigned long long *)p2;
-	return a - b;
+#ifdef __linux__
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof (set), &set) ? -1 : 0;
+#else
+	return -1;
+#endif
 }
 
-// not worth -lm for this
-int myceil(double x)
+#ifdef __linux__
+/*
+ * Opens a perf counter on this thread, user and kernel.
+ */
+int perf_open_self(unsigned int type, unsigned long long config)
 {
-	if (x > (int)x)
-		return (int)x + 1;
-	return (int)x;
-}
+	struct perf_event_attr attr;
 
-int g_mainrun = 1;
-void mainstop(int dummy) {
-	g_mainrun = 0;
-	printf("stopping...\n");
+	memset(&attr, 0, sizeof (attr));
+	attr.size = sizeof (attr);
+	attr.type = type;
+	attr.config = config;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
 }
+#endif
 
-// histogram bucket count
-#define BUCKETS	200
+/*
+ * Network loopback test (-n): request/response round trips between the
+ * benchmark thread and an echo server thread, over TCP or UDP on 127.0.0.1
+ * or an AF_UNIX socketpair. One iteration is one round trip. UDP requests
+ * start with a sequence number that the server echoes back: a reply that
+ * doesn't arrive within NET_TIMEOUT_MS is counted as lost, and replies
+ * to earlier requests that arrive late are discarded.
+ */
+#define NET_TIMEOUT_MS	100
 
-int main(int argc, char *argv[])
+int g_netfd[2] = {-1, -1};	// client, server
+int g_netudp;
+unsigned long long g_netseq;	// UDP request sequence number
+unsigned long long g_netlost;	// UDP round trips timed out
+unsigned long long g_msgsize;	// -s, default depends on the mode
+char *g_netbuf[2];
+int g_pincpu[2] = {-1, -1};	// benchmark/client, server/peer
+
+// send or receive a whole message, handling short stream transfers
+int netxfer(int fd, char *buf, unsigned long long len, int dosend)
 {
-	unsigned long long iter_count, time_us, time_usr_us,
-	    time_sys_us, ivcs, last_us, total_time_us, fastest_time_us,
-	    slowest_time_us;
-	unsigned long long target_us = 100 * 1000;	// default target ms
-	double slower_ms, diff_pct;
-	static struct timeval ts[2];
-	struct rusage u[2];
-	int test_us = 100 * 1000;
-	int test_runs = 5;	// calibration
-	int max_runs = 100;
-	int verbose = 0;
-	int hist[BUCKETS] = {0};
-	int bar_width = 50;
-	int c, i, j, runs, idx, max_idx;
-	unsigned long long *runs_us;
-	unsigned long long pagesize;
-	char *memp;
-	unsigned long long (*run)(unsigned long long) = spinrun;
-	void *(*test)(void *) = spintest;
+	unsigned long long done = 0;
+	ssize_t n;
 
-	// defaults
-	g_stride = 64;
-	g_memsize = 0;
+	while (done < len) {
+		if (dosend)
+			n = send(fd, buf + done, len - done, 0);
+		else
+			n = recv(fd, buf + done, len - done, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		done += n;
+	}
+	return 0;
+}
 
-	// options
-	while ((c = getopt(argc, argv, "hm:v")) != -1) {
-		switch (c) {
-		case 'm':
-			g_memsize = atoi(optarg) * 1024 * 1024;
-			if (!g_memsize) {
-				printf("-m Mbytes must be non-zero\n");
-				usage();
-				return 0;
-			}
-			run = memrun;
-			test = memtest;
-			break;
-		case 'v':
-			verbose = 1;
+static int netrtt(void)
+{
+	unsigned long long seq;
+
+	if (g_netudp) {
+		g_netseq++;
+		memcpy(g_netbuf[0], &g_netseq, sizeof (g_netseq));
+	}
+	if (netxfer(g_netfd[0], g_netbuf[0], g_msgsize, 1) != 0)
+		goto err;
+	for (;;) {
+		if (netxfer(g_netfd[0], g_netbuf[0], g_msgsize, 0) != 0)
 			break;
-		case 'h':
-			usage();
+		if (!g_netudp)
 			return 0;
-		default:
-			usage();
+		memcpy(&seq, g_netbuf[0], sizeof (seq));
+		if (seq == g_netseq)
 			return 0;
-		}
+		// a late reply to an earlier request
 	}
-	argc -= optind;
-	if (argc > 2) {
-		usage();
+	// only UDP sockets have a receive timeout
+	if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		g_netlost++;
+		// drop whatever has arrived since; later strays are skipped
+		while (recv(g_netfd[0], g_netbuf[0], g_msgsize,
+		    MSG_DONTWAIT) > 0)
+			;
 		return 0;
 	}
-	if (argc)
-		target_us = atoll(argv[optind]) * 1000;
-	if (argc > 1)
-		max_runs = atoll(argv[optind + 1]);
-	if (!target_us) {
-		printf("ERROR: target ms must be > 0\n");
-		usage();
-		return 1;
-	}
+err:
+	perror("Network round trip failed");
+	exit(1);
+}
 
-	// per-run statistics
-	if ((runs_us = malloc(max_runs * sizeof (time_us))) == NULL) {
-		printf("ERROR: can't allocate memory for %d runs\n", max_runs);
-		return 1;
+void *netserver(void *arg)
+{
+	for (;;) {
+		if (netxfer(g_netfd[1], g_netbuf[1], g_msgsize, 0) != 0 ||
+		    netxfer(g_netfd[1], g_netbuf[1], g_msgsize, 1) != 0)
+			break;
 	}
+	return NULL;
+}
 
-	/*
-	 * populate working set
-	 */
-	if (g_memsize) {
-		printf("Allocating %llu Mbytes...\n",
-		    g_memsize / (1024 * 1024));
-		if ((g_mem = malloc(g_memsize)) == NULL) {
-			printf("ERROR allocating -m memory. Exiting.\n");
-			return 1;
-		}
-		pagesize = getpagesize();
-		for (memp = g_mem; memp < (g_mem + g_memsize);
-		    memp += pagesize) {
-			memp[0] = 'A';
+void *nettest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+
+	signal(SIGUSR1, teststop);
+	for (;g_testrun;) {
+		(void) netrtt();
+		(*count)++;
+	}
+	return NULL;
+}
+
+unsigned long long netrun(unsigned long long count)
+{
+	unsigned long long i;
+
+	for (i = 0; i < count; i++)
+		(void) netrtt();
+	return i;
+}
+
+/*
+ * Creates the connected client and server sockets, and starts the server.
+ */
+int net_setup(const char *proto)
+{
+	struct sockaddr_in addr;
+	struct timeval tv;
+	socklen_t len = sizeof (addr);
+	pthread_t thread;
+	int lfd, one = 1;
+
+	memset(&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (strcmp(proto, "unix") == 0) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_netfd) != 0)
+			goto err;
+	} else if (strcmp(proto, "tcp") == 0) {
+		if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+		    bind(lfd, (struct sockaddr *)&addr, len) != 0 ||
+		    listen(lfd, 1) != 0 ||
+		    getsockname(lfd, (struct sockaddr *)&addr, &len) != 0 ||
+		    (g_netfd[0] = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+		    connect(g_netfd[0], (struct sockaddr *)&addr, len) != 0 ||
+		    (g_netfd[1] = accept(lfd, NULL, NULL)) < 0)
+			goto err;
+		close(lfd);
+		setsockopt(g_netfd[0], IPPROTO_TCP, TCP_NODELAY, &one,
+		    sizeof (one));
+		setsockopt(g_netfd[1], IPPROTO_TCP, TCP_NODELAY, &one,
+		    sizeof (one));
+	} else {
+		struct sockaddr_in peer;	// udp
+
+		if (g_msgsize > 65507 || g_msgsize < sizeof (g_netseq)) {
+			printf("ERROR: UDP message size must be %d to 65507, "
+			    "for the sequence number\n",
+			    (int)sizeof (g_netseq));
+			return -1;
+		}
+		g_netudp = 1;
+		if ((g_netfd[0] = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+		    (g_netfd[1] = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+		    bind(g_netfd[0], (struct sockaddr *)&addr, len) != 0 ||
+		    bind(g_netfd[1], (struct sockaddr *)&addr, len) != 0 ||
+		    getsockname(g_netfd[0], (struct sockaddr *)&addr,
+		    &len) != 0 ||
+		    getsockname(g_netfd[1], (struct sockaddr *)&peer,
+		    &len) != 0 ||
+		    connect(g_netfd[0], (struct sockaddr *)&peer, len) != 0 ||
+		    connect(g_netfd[1], (struct sockaddr *)&addr, len) != 0)
+			goto err;
+		// a dropped request or reply would otherwise block forever
+		tv.tv_sec = 0;
+		tv.tv_usec = NET_TIMEOUT_MS * 1000;
+		if (setsockopt(g_netfd[0], SOL_SOCKET, SO_RCVTIMEO, &tv,
+		    sizeof (tv)) != 0)
+			goto err;
+	}
+
+	if ((g_netbuf[0] = calloc(1, g_msgsize)) == NULL ||
+	    (g_netbuf[1] = calloc(1, g_msgsize)) == NULL ||
+	    pthread_create(&thread, NULL, netserver, NULL) != 0)
+		goto err;
+	if (g_pincpu[1] >= 0 && pin_cpu(thread, g_pincpu[1]) != 0)
+		printf("WARNING: couldn't pin server to CPU %d\n", g_pincpu[1]);
+	return 0;
+
+err:
+	perror("ERROR: loopback setup failed");
+	return -1;
+}
+
+/*
+ * IPC test (-i): the benchmark thread sends messages to a peer thread.
+ * pipe: write()s of -s bytes, drained by the peer with read().
+ * splice: vmsplice()s of -s bytes (page references, no copy), drained by
+ *     the peer with splice() to /dev/null.
+ * eventfd: a wakeup round trip: signal the peer and wait for its reply.
+ * One iteration is one message.
+ */
+#define IPC_PIPE	1
+#define IPC_EVENTFD	2
+#define IPC_SPLICE	3
+int g_ipctype;
+int g_ipcfd[4] = {-1, -1, -1, -1};	// pipe read, write; eventfd to, from
+int g_devnull = -1;
+char *g_ipcbuf[2];
+
+static void ipcsend(void)
+{
+	unsigned long long done = 0;
+	ssize_t n;
+#ifdef __linux__
+	uint64_t one = 1, val;
+	struct iovec iov;
+#endif
+
+	switch (g_ipctype) {
+	case IPC_PIPE:
+		while (done < g_msgsize) {
+			n = write(g_ipcfd[1], g_ipcbuf[0] + done,
+			    g_msgsize - done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				goto err;
+			done += n;
+		}
+		break;
+#ifdef __linux__
+	case IPC_SPLICE:
+		while (done < g_msgsize) {
+			iov.iov_base = g_ipcbuf[0] + done;
+			iov.iov_len = g_msgsize - done;
+			n = vmsplice(g_ipcfd[1], &iov, 1, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				goto err;
+			done += n;
+		}
+		break;
+	case IPC_EVENTFD:
+		if (write(g_ipcfd[2], &one, sizeof (one)) != sizeof (one))
+			goto err;
+		while ((n = read(g_ipcfd[3], &val, sizeof (val))) < 0 &&
+		    errno == EINTR)
+			;
+		if (n != sizeof (val))
+			goto err;
+		break;
+#endif
+	}
+	return;
+
+err:
+	perror("IPC send failed");
+	exit(1);
+}
+
+void *ipcpeer(void *arg)
+{
+	ssize_t n;
+#ifdef __linux__
+	uint64_t one = 1, val;
+#endif
+
+	for (;;) {
+		switch (g_ipctype) {
+		case IPC_PIPE:
+			n = read(g_ipcfd[0], g_ipcbuf[1], g_msgsize);
+			break;
+#ifdef __linux__
+		case IPC_SPLICE:
+			n = splice(g_ipcfd[0], NULL, g_devnull, NULL,
+			    g_msgsize, SPLICE_F_MOVE);
+			break;
+		case IPC_EVENTFD:
+			if ((n = read(g_ipcfd[2], &val, sizeof (val))) > 0)
+				n = write(g_ipcfd[3], &one, sizeof (one));
+			break;
+#endif
+		default:
+			n = 0;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+	}
+	return NULL;
+}
+
+void *ipctest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+
+	signal(SIGUSR1, teststop);
+	for (;g_testrun;) {
+		ipcsend();
+		(*count)++;
+	}
+	return NULL;
+}
+
+unsigned long long ipcrun(unsigned long long count)
+{
+	unsigned long long i;
+
+	for (i = 0; i < count; i++)
+		ipcsend();
+	return i;
+}
+
+int ipc_setup(void)
+{
+	pthread_t thread;
+
+	if (pipe(g_ipcfd) != 0)
+		goto err;
+#ifdef __linux__
+	if (g_ipctype == IPC_EVENTFD &&
+	    ((g_ipcfd[2] = eventfd(0, 0)) < 0 ||
+	    (g_ipcfd[3] = eventfd(0, 0)) < 0))
+		goto err;
+	if (g_ipctype == IPC_SPLICE &&
+	    (g_devnull = open("/dev/null", O_WRONLY)) < 0)
+		goto err;
+#endif
+	if ((g_ipcbuf[0] = calloc(1, g_msgsize)) == NULL ||
+	    (g_ipcbuf[1] = calloc(1, g_msgsize)) == NULL ||
+	    pthread_create(&thread, NULL, ipcpeer, NULL) != 0)
+		goto err;
+	if (g_pincpu[1] >= 0 && pin_cpu(thread, g_pincpu[1]) != 0)
+		printf("WARNING: couldn't pin peer to CPU %d\n", g_pincpu[1]);
+	return 0;
+
+err:
+	perror("ERROR: IPC setup failed");
+	return -1;
+}
+
+// not worth -lm for this
+int myceil(double x)
+{
+	if (x > (int)x)
+		return (int)x + 1;
+	return (int)x;
+}
+
+// Newton's method, for the same reason
+double mysqrt(double x)
+{
+	double r = x > 1 ? x : 1;
+	int i;
+
+	if (x <= 0)
+		return 0;
+	for (i = 0; i < 100 && r * r - x > x * 1e-12; i++)
+		r = (r + x / r) / 2;
+	return r;
+}
+
+/*
+ * Pearson's correlation coefficient from sums over n pairs, or -2 if
+ * either side doesn't vary.
+ */
+double pearson(int n, double sx, double sy, double sxx, double syy,
+    double sxy)
+{
+	double var;
+
+	var = (n * sxx - sx * sx) * (n * syy - sy * sy);
+	if (var <= 0)
+		return -2;
+	return (n * sxy - sx * sy) / mysqrt(var);
+}
+
+/*
+ * Power-of-2 histograms, for per-event latency distributions where
+ * storing every sample isn't practical.
+ */
+#define LOG2_SLOTS	64
+
+static int log2_slot(unsigned long long value)
+{
+	int slot = 0;
+
+	while (value >>= 1)
+		slot++;
+	return slot;
+}
+
+void print_log2_hist(const char *unit, unsigned long long *slots)
+{
+	unsigned long long max = 0, low, high;
+	int bar_width = 40;
+	int i, j, first = -1, last = -1, bar;
+
+	for (i = 0; i < LOG2_SLOTS; i++) {
+		if (!slots[i])
+			continue;
+		if (first < 0)
+			first = i;
+		last = i;
+		if (slots[i] > max)
+			max = slots[i];
+	}
+	if (first < 0)
+		return;
+	printf("%24s : %-10s %s\n", unit, "count", "distribution");
+	for (i = first; i <= last; i++) {
+		low = i ? 1ULL << i : 0;
+		high = (1ULL << (i + 1)) - 1;
+		printf("%10llu -> %-10llu : %-10llu |", low, high, slots[i]);
+		bar = myceil((double)bar_width * slots[i] / max);
+		for (j = 0; j < bar_width; j++)
+			printf("%s", j < bar ? "*" : " ");
+		printf("|\n");
+	}
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Pointer chasing (-w chase): each stride of the working set holds a
+ * pointer to the next, in a random cyclic order, so every load depends on
+ * the one before and prefetchers can't help. This measures load latency
+ * rather than bandwidth. With -l, one load in LAT_SAMPLE is timed on its
+ * own: fenced with rdtscp and lfence on x86, in TSC cycles, or with
+ * CLOCK_MONOTONIC elsewhere, in much coarser ns.
+ */
+#define LAT_SAMPLE	64
+#define LAT_LINEAR	4096	// exact percentiles below this
+
+int g_latency;
+unsigned long long g_lathist[LOG2_SLOTS];
+unsigned long long g_latlin[LAT_LINEAR + 1];	// the last is overflow
+char **g_chasejunk;	// keeps the loads live
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LAT_UNIT	"cycles"
+static inline unsigned long long lat_now(void)
+{
+	unsigned long long t;
+	unsigned int aux;
+
+	// rdtscp waits for earlier loads; lfence holds back later ones
+	t = __rdtscp(&aux);
+	_mm_lfence();
+	return t;
+}
+#else
+#define LAT_UNIT	"ns"
+#define lat_now()	now_ns()
+#endif
+
+void chase_init(char *mem, unsigned long long size)
+{
+	unsigned long long n, i, j, tmp, *order;
+	unsigned int seed = 1;
+
+	n = size / g_stride;
+	if ((order = malloc(n * sizeof (*order))) == NULL) {
+		printf("ERROR: can't allocate the pointer chasing order\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	// shuffle all but the first, so runs from mem start on the cycle
+	for (i = n - 1; i > 1; i--) {
+		j = 1 + (((unsigned long long)rand_r(&seed) << 31) ^
+		    rand_r(&seed)) % i;
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < n; i++)
+		*(char **)(mem + order[i] * g_stride) =
+		    mem + order[(i + 1) % n] * g_stride;
+	free(order);
+}
+
+void *chasetest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+	char **p;
+
+	signal(SIGUSR1, teststop);
+	p = (char **)g_mem;
+	for (;g_testrun;) {
+		p = (char **)*p;
+		(*count)++;
+	}
+	g_chasejunk = p;
+
+	return NULL;
+}
+
+unsigned long long memchase(char *mem, unsigned long long size,
+    unsigned long long count)
+{
+	unsigned long long i, t;
+	char **p = (char **)mem;
+
+	if (!g_latency) {
+		for (i = 0; i < count; i++)
+			p = (char **)*p;
+		g_chasejunk = p;
+		return i;
+	}
+	for (i = 0; i < count; i++) {
+		if (i % LAT_SAMPLE) {
+			p = (char **)*p;
+			continue;
+		}
+		t = lat_now();
+		p = (char **)*p;
+		t = lat_now() - t;
+		g_lathist[log2_slot(t)]++;
+		g_latlin[t < LAT_LINEAR ? t : LAT_LINEAR]++;
+	}
+	g_chasejunk = p;
+	return i;
+}
+
+// latency value at a percentile of the linear histogram
+static unsigned long long lat_pctile(double pct)
+{
+	unsigned long long total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i <= LAT_LINEAR; i++)
+		total += g_latlin[i];
+	for (i = 0; i <= LAT_LINEAR; i++) {
+		sum += g_latlin[i];
+		if (sum * 100 >= total * pct)
+			break;
+	}
+	return i;
+}
+
+void print_latency(void)
+{
+	const double pcts[] = { 50, 90, 99, 99.9 };
+	unsigned long long t, floor = ~0ULL;
+	double per_ns = 1;
+	int i;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned long long c0, t0;
+
+	// TSC rate against CLOCK_MONOTONIC, to convert cycles to ns
+	t0 = now_ns();
+	c0 = __rdtsc();
+	usleep(20 * 1000);
+	per_ns = (double)(__rdtsc() - c0) / (now_ns() - t0);
+#endif
+
+	for (i = 0; i < 1000; i++) {
+		t = lat_now();
+		t = lat_now() - t;
+		if (t < floor)
+			floor = t;
+	}
+	printf("\nPer-load latency (1 in %d loads sampled, including about "
+	    "%llu %s of timing):\n", LAT_SAMPLE, floor, LAT_UNIT);
+	print_log2_hist(LAT_UNIT, g_lathist);
+	printf("Load latency %s (ns):", LAT_UNIT);
+	for (i = 0; i < 4; i++) {
+		t = lat_pctile(pcts[i]);
+		printf("%s %gth: %s%llu (%.0f)", i ? "," : "", pcts[i],
+		    t == LAT_LINEAR ? ">" : "", t, t / per_ns);
+	}
+	printf("\n");
+#if defined(__x86_64__) || defined(__i386__)
+	printf("TSC rate: %.3f GHz\n", per_ns);
+#endif
+}
+
+/*
+ * io_uring test (-u): batches of queue depth (-q) random reads of -s bytes
+ * from a file, using raw io_uring syscalls. One iteration is one batch:
+ * submit them all, then reap all completions. Completions are waited for
+ * in io_uring_enter(), or by spinning on the completion ring (-U poll).
+ */
+#ifdef HAVE_IO_URING
+struct uring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+} g_ring;
+#endif
+int g_uringfd = -1;
+unsigned g_qdepth = 8;
+int g_uring_poll, g_uring_iopoll, g_uring_fixed, g_uring_direct;
+char *g_uringbuf;
+unsigned long long g_uring_blocks;
+unsigned long long *g_uring_start;
+unsigned long long g_iohist[LOG2_SLOTS], g_batchhist[LOG2_SLOTS];
+unsigned int g_seed = 1;
+
+#ifdef HAVE_IO_URING
+static int uring_enter(unsigned submit, unsigned complete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, g_ring.fd, submit, complete,
+	    flags, NULL, 0);
+}
+
+static void uringbatch(void)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned long long start, end;
+	unsigned tail, head, i, done;
+
+	start = now_ns();
+	tail = *g_ring.sq_tail;
+	for (i = 0; i < g_qdepth; i++) {
+		sqe = &g_ring.sqes[i];
+		memset(sqe, 0, sizeof (*sqe));
+		sqe->opcode = g_uring_fixed ? IORING_OP_READ_FIXED :
+		    IORING_OP_READ;
+		sqe->fd = g_uringfd;
+		sqe->addr = (unsigned long)(g_uringbuf + i * g_msgsize);
+		sqe->len = g_msgsize;
+		sqe->off = (rand_r(&g_seed) % g_uring_blocks) * g_msgsize;
+		sqe->user_data = i;
+		g_ring.sq_array[(tail + i) & *g_ring.sq_mask] = i;
+		g_uring_start[i] = now_ns();
+	}
+	__atomic_store_n(g_ring.sq_tail, tail + g_qdepth, __ATOMIC_RELEASE);
+
+	/*
+	 * Submit without waiting, then reap one completion at a time, so each
+	 * IO is timed when it completes rather than when the whole batch has.
+	 * IOPOLL completions are only found by io_uring_enter().
+	 */
+	if (uring_enter(g_qdepth, 0, 0) < 0)
+		goto err;
+
+	for (done = 0; done < g_qdepth;) {
+		head = *g_ring.cq_head;
+		if (head == __atomic_load_n(g_ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			if ((!g_uring_poll || g_uring_iopoll) &&
+			    uring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+				goto err;
+			continue;
+		}
+		cqe = &g_ring.cqes[head & *g_ring.cq_mask];
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			goto err;
+		}
+		end = now_ns();
+		g_iohist[log2_slot((end - g_uring_start[cqe->user_data]) /
+		    1000)]++;
+		__atomic_store_n(g_ring.cq_head, head + 1, __ATOMIC_RELEASE);
+		done++;
+	}
+	g_batchhist[log2_slot((now_ns() - start) / 1000)]++;
+	return;
+
+err:
+	perror("io_uring read failed");
+	exit(1);
+}
+
+void *uringtest(void *arg)
+{
+	unsigned long long *count = (unsigned long long *)arg;
+
+	signal(SIGUSR1, teststop);
+	for (;g_testrun;) {
+		uringbatch();
+		(*count)++;
+	}
+	return NULL;
+}
+
+unsigned long long uringrun(unsigned long long count)
+{
+	unsigned long long i;
+
+	for (i = 0; i < count; i++)
+		uringbatch();
+	return i;
+}
+
+int uring_setup(const char *file)
+{
+	struct io_uring_params params;
+	struct iovec iov;
+	struct stat st;
+	char *sq, *cq;
+	size_t sqlen, cqlen;
+
+	if ((g_uringfd = open(file, O_RDONLY |
+	    (g_uring_direct ? O_DIRECT : 0))) < 0 ||
+	    fstat(g_uringfd, &st) != 0) {
+		printf("ERROR: can't open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if ((g_uring_blocks = st.st_size / g_msgsize) == 0) {
+		printf("ERROR: %s is smaller than -s %llu bytes\n", file,
+		    g_msgsize);
+		return -1;
+	}
+
+	memset(&params, 0, sizeof (params));
+	if (g_uring_iopoll)
+		params.flags |= IORING_SETUP_IOPOLL;
+	if ((g_ring.fd = syscall(__NR_io_uring_setup, g_qdepth,
+	    &params)) < 0)
+		goto err;
+
+	sqlen = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	cqlen = params.cq_off.cqes +
+	    params.cq_entries * sizeof (struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) && cqlen > sqlen)
+		sqlen = cqlen;
+	sq = mmap(NULL, sqlen, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, g_ring.fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto err;
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, cqlen, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, g_ring.fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto err;
+	}
+	g_ring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	g_ring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	g_ring.sq_array = (unsigned *)(sq + params.sq_off.array);
+	g_ring.cq_head = (unsigned *)(cq + params.cq_off.head);
+	g_ring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	g_ring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	g_ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	g_ring.sqes = mmap(NULL, params.sq_entries *
+	    sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, g_ring.fd, IORING_OFF_SQES);
+	if (g_ring.sqes == MAP_FAILED)
+		goto err;
+
+	// aligned for O_DIRECT
+	if (posix_memalign((void **)&g_uringbuf, 4096,
+	    g_qdepth * g_msgsize) != 0 ||
+	    (g_uring_start = calloc(g_qdepth,
+	    sizeof (unsigned long long))) == NULL)
+		goto err;
+	memset(g_uringbuf, 0, g_qdepth * g_msgsize);
+	if (g_uring_fixed) {
+		iov.iov_base = g_uringbuf;
+		iov.iov_len = g_qdepth * g_msgsize;
+		if (syscall(__NR_io_uring_register, g_ring.fd,
+		    IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+			goto err;
+	}
+	return 0;
+
+err:
+	perror("ERROR: io_uring setup failed");
+	return -1;
+}
+#endif	/* HAVE_IO_URING */
+
+/*
+ * Runs the loop function for the target_us while incrementing count.
+ * This gives us a ballpark figure of the target count.
+ */
+void test_run(unsigned long long target_us, unsigned long long *count,
+    void *(*loop)(void *))
+{
+	pthread_t thread;
+	int err;
+
+	if (!target_us)
+		return;
+
+	g_testrun = 1;
+	(*count) = 0;
+	if (pthread_create(&thread, NULL, loop, count) != 0) {
+		perror("Thread create failed");
+		exit(1);
+	}
+	usleep(target_us);
+	if ((err = pthread_kill(thread, SIGUSR1))) {
+		perror("Couldn't terminate worker thread normally");
+		exit(1);
+	}
+	pthread_join(thread, NULL);
+}
+
+/*
+ * Finds a ballpark target count, then runs the real run function with that
+ * count several times (test_runs) to fine tune the target count.
+ */
+unsigned long long find_count(unsigned long long target_us,
+    int test_us, int test_runs,
+    void *(*test)(void *),
+    unsigned long long (*run)(unsigned long long))
+{
+	unsigned long long time_us;
+	unsigned long long fastest_time_us = ~0ULL;
+	unsigned long long iter_count = 0;
+	static struct timeval ts[2];
+	int i;
+
+	test_run(test_us, &iter_count, test);
+	for (i = 0; i < test_runs; i++) {
+		gettimeofday(&ts[0], NULL);
+		(void) run(iter_count);
+		gettimeofday(&ts[1], NULL);
+		time_us = 1000000 * (ts[1].tv_sec - ts[0].tv_sec) +
+		    (ts[1].tv_usec - ts[0].tv_usec) / 1;
+		if (time_us < fastest_time_us)
+			fastest_time_us = time_us;
+	}
+	return iter_count * target_us / fastest_time_us;
+}
+
+/*
+ * File helpers for /proc and /sys.
+ */
+int readfile_ull(const char *path, unsigned long long *val)
+{
+	FILE *fp;
+	int ok;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	ok = fscanf(fp, "%llu", val) == 1;
+	fclose(fp);
+	return ok ? 0 : -1;
+}
+
+// reads the first line of a file, without the newline
+int readfile_str(const char *path, char *buf, int len)
+{
+	char line[4096];
+	FILE *fp;
+	int ok;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	ok = fgets(line, sizeof (line), fp) != NULL;
+	fclose(fp);
+	if (!ok)
+		return -1;
+	line[strcspn(line, "\n")] = '\0';
+	snprintf(buf, len, "%s", line);
+	return 0;
+}
+
+int writefile(const char *path, const char *str)
+{
+	int fd, ok;
+
+	if ((fd = open(path, O_WRONLY)) < 0)
+		return -1;
+	ok = write(fd, str, strlen(str)) == strlen(str);
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+/*
+ * resctrl (Intel RDT, AMD QoS): LLC occupancy and memory bandwidth
+ * monitoring (-R), and running inside a cache allocation partition (-C).
+ * With -C, runs alternate between the partition and the root group so the
+ * two can be compared under the same conditions.
+ */
+#define RESCTRL	"/sys/fs/resctrl"
+
+char g_rdt_mon[PATH_MAX];	// monitoring group, outside the partition
+char g_rdt_ctrl[PATH_MAX];	// control group, inside the partition
+
+void rdt_cleanup(void)
+{
+	// removing a group moves its tasks back to the parent
+	if (g_rdt_mon[0])
+		rmdir(g_rdt_mon);
+	if (g_rdt_ctrl[0])
+		rmdir(g_rdt_ctrl);
+}
+
+// moves this thread (and threads it creates later) into a group
+int rdt_join(const char *group)
+{
+	char path[PATH_MAX], pid[32];
+
+	snprintf(path, sizeof (path), "%s/tasks", group);
+	snprintf(pid, sizeof (pid), "%d\n", getpid());
+	return writefile(path, pid);
+}
+
+/*
+ * Sums LLC occupancy (bytes) and total MBM bytes across all L3 domains of
+ * a group. Values the hardware reports as "Unavailable" are skipped.
+ */
+int rdt_read(const char *group, unsigned long long *llc,
+    unsigned long long *mbm)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	unsigned long long val;
+	DIR *dir;
+
+	*llc = *mbm = 0;
+	snprintf(path, sizeof (path), "%s/mon_data", group);
+	if ((dir = opendir(path)) == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL) {
+		if (strncmp(de->d_name, "mon_L3_", 7) != 0)
+			continue;
+		snprintf(path, sizeof (path), "%s/mon_data/%s/llc_occupancy",
+		    group, de->d_name);
+		if (readfile_ull(path, &val) == 0)
+			*llc += val;
+		snprintf(path, sizeof (path), "%s/mon_data/%s/mbm_total_bytes",
+		    group, de->d_name);
+		if (readfile_ull(path, &val) == 0)
+			*mbm += val;
+	}
+	closedir(dir);
+	return 0;
+}
+
+/*
+ * Creates the resctrl groups. A CAT partition uses the lowest "ways" bits
+ * of the L3 capacity bitmask on every L3 domain.
+ */
+int rdt_setup(int monitor, int ways)
+{
+	char path[PATH_MAX], line[1024], schemata[1024];
+	unsigned long long cbm_mask, mask;
+	char *p, *tok, *save;
+	FILE *fp;
+	int bits;
+
+	if (access(RESCTRL "/info", F_OK) != 0) {
+		printf("ERROR: resctrl not mounted at %s (mount -t resctrl "
+		    "resctrl %s)\n", RESCTRL, RESCTRL);
+		return -1;
+	}
+	atexit(rdt_cleanup);
+
+	if (monitor) {
+		snprintf(path, sizeof (path), "%s/mon_groups/p1bench_%d",
+		    RESCTRL, getpid());
+		if (mkdir(path, 0755) != 0) {
+			printf("ERROR: creating resctrl group %s: %s\n", path,
+			    strerror(errno));
+			return -1;
+		}
+		strcpy(g_rdt_mon, path);
+		if (rdt_join(g_rdt_mon) != 0) {
+			printf("ERROR: joining resctrl group %s\n", path);
+			return -1;
+		}
+	}
+
+	if (!ways)
+		return 0;
+
+	if ((fp = fopen(RESCTRL "/info/L3/cbm_mask", "r")) == NULL ||
+	    fscanf(fp, "%llx", &cbm_mask) != 1) {
+		printf("ERROR: no L3 cache allocation support\n");
+		if (fp)
+			fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	for (bits = 0; cbm_mask >> bits; bits++)
+		;
+	if (ways >= bits) {
+		printf("ERROR: -C ways must be less than the %d L3 ways\n",
+		    bits);
+		return -1;
+	}
+	mask = (1ULL << ways) - 1;
+
+	// "L3:0=fff;1=fff" -> "L3:0=<mask>;1=<mask>"
+	if ((fp = fopen(RESCTRL "/schemata", "r")) == NULL)
+		return -1;
+	schemata[0] = '\0';
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		for (p = line; *p == ' '; p++)
+			;
+		if (strncmp(p, "L3:", 3) != 0)
+			continue;
+		strcpy(schemata, "L3:");
+		for (tok = strtok_r(p + 3, ";\n", &save); tok != NULL;
+		    tok = strtok_r(NULL, ";\n", &save)) {
+			snprintf(schemata + strlen(schemata),
+			    sizeof (schemata) - strlen(schemata), "%s%d=%llx",
+			    schemata[3] ? ";" : "", atoi(tok), mask);
+		}
+		strcat(schemata, "\n");
+		break;
+	}
+	fclose(fp);
+	if (!schemata[0]) {
+		printf("ERROR: no L3 line in %s/schemata\n", RESCTRL);
+		return -1;
+	}
+
+	snprintf(path, sizeof (path), "%s/p1bench_%d", RESCTRL, getpid());
+	if (mkdir(path, 0755) != 0) {
+		printf("ERROR: creating resctrl group %s: %s\n", path,
+		    strerror(errno));
+		return -1;
+	}
+	strcpy(g_rdt_ctrl, path);
+	snprintf(path, sizeof (path), "%s/p1bench_%d/schemata", RESCTRL,
+	    getpid());
+	if (writefile(path, schemata) != 0) {
+		printf("ERROR: writing %s: %s", path, schemata);
+		return -1;
+	}
+	printf("CAT partition: %d of %d L3 ways (mask %llx)\n", ways, bits,
+	    mask);
+	return 0;
+}
+
+/*
+ * Value to histogram index.
+ * This is a custom histogram with the following ranges:
+ *     value 0-1: 0.1 step size, idx 0-9
+ *     value 1-20: 1 step size, idx 10-28
+ *     value 20+: 10 step size, idx 19+
+ */
+static int hist_idx(double value, int buckets)
+{
+	int idx;
+
+	if (value < 1)
+		idx = (int)(10 * value);
+	else if (value < 20)
+		// idx = previous_steps + (value - min_range_value)
+		idx = 10 + (int)(value - 1);
+	else
+		// idx = previous_steps + (value - min_range_value)/10
+		idx = 29 + (int)((value - 20) / 10);
+
+	if (idx > buckets - 1)
+		idx = buckets - 1;
+	return idx;
+}
+
+// histogram index to minimum value
+double hist_val(int idx)
+{
+	if (idx < 10)
+		return (double)idx / 10;
+	else if (idx < 29)
+		// 10 -> 1.0
+		// 11 -> 2
+		// value = idx - previous_steps + min_range_value
+		return (double)idx - 10 + 1;
+	else
+		// value = (idx - previous_steps) * 10 + min_range_value
+		return (double)(idx - 29) * 10 + 20;
+}
+
+static int ullcmp(const void *p1, const void *p2)
+{
+	unsigned long long a = *(unsigned long long *)p1;
+	unsigned long long b = *(unsigned long long *)p2;
+	return a < b ? -1 : a > b;
+}
+
+static int doublecmp(const void *p1, const void *p2)
+{
+	double a = *(double *)p1;
+	double b = *(double *)p2;
+	return a < b ? -1 : a > b;
+}
+
+int g_mainrun = 1;
+void mainstop(int dummy) {
+	g_mainrun = 0;
+	printf("stopping...\n");
+}
+
+// histogram bucket count
+#define BUCKETS	200
+
+/*
+ * Prints a histogram of percentages (eg, percent slower than the fastest
+ * run), using the custom bucket ranges of hist_idx().
+ */
+int print_hist(double *pcts, int runs)
+{
+	int hist[BUCKETS] = {0};
+	int bar_width = 50;
+	int i, j, idx, bar, max_idx, max_bucket_count;
+	double min;
+
+	max_idx = 0;
+	for (i = 0; i < runs; i++) {
+		idx = hist_idx(pcts[i], BUCKETS);
+		if (idx < 0) {
+			// shouldn't happen
+			printf("ERROR: negative hist idx; fix program.\n");
+			return -1;
+		}
+		hist[idx]++;
+		if (idx > max_idx)
+			max_idx = idx;
+	}
+	max_bucket_count = 0;
+	for (i = 0; i <= max_idx; i++) {
+		if (hist[i] > max_bucket_count)
+			max_bucket_count = hist[i];
+	}
+
+	printf("%9s  %6s %7s %s\n", "Slower%", "Count", "Count%", "Histogram");
+	for (i = 0; i <= max_idx; i++) {
+		min = hist_val(i);
+		printf("%8.1f%%%s %6d %6.2f%% ", min,
+		    i == BUCKETS - 1 ? "+" : ":", hist[i],
+		    (double)100 * hist[i] / runs);
+		bar = myceil((double)bar_width * hist[i] / max_bucket_count);
+		for (j = 0; j < bar; j++)
+			printf("*");
+		printf("\n");
+	}
+	return 0;
+}
+
+/*
+ * Fixed-time runs (-T): the loop is run in chunks, polling the clock
+ * between them, until target_us has passed. Returns iterations completed.
+ */
+unsigned long long timedrun(unsigned long long (*run)(unsigned long long),
+    unsigned long long chunk, unsigned long long target_us)
+{
+	unsigned long long iters = 0, end;
+
+	end = now_ns() + target_us * 1000;
+	do {
+		iters += run(chunk);
+	} while (now_ns() < end);
+	return iters;
+}
+
+/*
+ * Continues the memory loop from where the last call left off, so that
+ * running it in chunks (-T) still walks the whole working set.
+ */
+unsigned long long memrun_cont(unsigned long long count)
+{
+	static unsigned long long pos;	// in strides
+	unsigned long long steps;
+
+	steps = (g_memsize + g_stride - 1) / g_stride;
+	memrun_at(g_mem, g_memsize, pos, count);
+	pos = (pos + count) % steps;
+	return count;
+}
+
+/*
+ * Self-overhead (-O): the cost and variance of the calls p1bench uses to
+ * time and attribute runs. Each call is timed individually with
+ * CLOCK_MONOTONIC, less the cost of an empty timing pair.
+ */
+#define OVERHEAD_SAMPLES	10000
+
+int g_perffd = -1;
+int g_statfd = -1;
+
+static void ov_gettimeofday(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+}
+
+static void ov_monotonic(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+#ifdef CLOCK_MONOTONIC_RAW
+static void ov_monotonic_raw(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+}
+#endif
+
+static void ov_realtime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+}
+
+static void ov_thread_cputime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void ov_rdtsc(void)
+{
+	(void) __rdtsc();
+}
+#endif
+
+static void ov_getrusage(void)
+{
+	struct rusage u;
+
+	getrusage(RUSAGE_SELF, &u);
+}
+
+static void ov_perf_read(void)
+{
+	unsigned long long val;
+
+	if (read(g_perffd, &val, sizeof (val)) != sizeof (val))
+		g_perffd = -1;
+}
+
+static void ov_proc_self_stat(void)
+{
+	char buf[1024];
+	int fd;
+
+	if ((fd = open("/proc/self/stat", O_RDONLY)) >= 0) {
+		(void) read(fd, buf, sizeof (buf));
+		close(fd);
+	}
+}
+
+static void ov_proc_stat(void)
+{
+	char buf[8192];
+
+	if (pread(g_statfd, buf, sizeof (buf), 0) < 0)
+		g_statfd = -1;
+}
+
+struct overhead {
+	const char *name;
+	void (*func)(void);
+	int *needfd;		// skipped if this is < 0
+} g_overheads[] = {
+	{ "gettimeofday",			ov_gettimeofday },
+	{ "clock_gettime(MONOTONIC)",		ov_monotonic },
+#ifdef CLOCK_MONOTONIC_RAW
+	{ "clock_gettime(MONOTONIC_RAW)",	ov_monotonic_raw },
+#endif
+	{ "clock_gettime(REALTIME)",		ov_realtime },
+	{ "clock_gettime(THREAD_CPUTIME)",	ov_thread_cputime },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "rdtsc",				ov_rdtsc },
+#endif
+	{ "getrusage(SELF)",			ov_getrusage },
+	{ "perf counter read",			ov_perf_read, &g_perffd },
+	{ "/proc/self/stat open+read",		ov_proc_self_stat },
+	{ "/proc/stat pread",			ov_proc_stat, &g_statfd },
+	{ NULL }
+};
+
+/*
+ * Prints the overhead table, and returns the median cost of gettimeofday()
+ * in nanoseconds: the part of the per-run instrumentation that falls
+ * inside the timed window.
+ */
+unsigned long long print_overhead(void)
+{
+	unsigned long long *samples, floor_ns = ~0ULL, t0, t1, gtod_ns = 0;
+	struct overhead *ov;
+	int i, n;
+
+#ifdef __linux__
+	g_perffd = perf_open_self(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	if (g_perffd < 0)
+		g_perffd = perf_open_self(PERF_TYPE_SOFTWARE,
+		    PERF_COUNT_SW_TASK_CLOCK);
+#endif
+	g_statfd = open("/proc/stat", O_RDONLY);
+
+	if ((samples = malloc(OVERHEAD_SAMPLES * sizeof (t0))) == NULL)
+		return 0;
+	for (i = 0; i < OVERHEAD_SAMPLES; i++) {
+		t0 = now_ns();
+		t1 = now_ns();
+		if (t1 - t0 < floor_ns)
+			floor_ns = t1 - t0;
+	}
+
+	printf("Measurement overhead per call (ns), less %llu ns timing "
+	    "floor:\n", floor_ns);
+	printf("%-30s %8s %8s %8s %10s\n", "CALL", "MIN", "50th", "99th",
+	    "MAX");
+	for (ov = g_overheads; ov->name; ov++) {
+		if (ov->needfd && *ov->needfd < 0) {
+			printf("%-30s %8s\n", ov->name, "-");
+			continue;
+		}
+		// /proc reads are slow, so fewer samples
+		n = strncmp(ov->name, "/proc", 5) == 0 ?
+		    OVERHEAD_SAMPLES / 10 : OVERHEAD_SAMPLES;
+		for (i = 0; i < n; i++) {
+			t0 = now_ns();
+			ov->func();
+			t1 = now_ns();
+			samples[i] = t1 - t0 > floor_ns ? t1 - t0 - floor_ns : 0;
+		}
+		qsort(samples, n, sizeof (t0), ullcmp);
+		printf("%-30s %8llu %8llu %8llu %10llu\n", ov->name,
+		    samples[0], samples[n / 2], samples[n * 99 / 100 - 1],
+		    samples[n - 1]);
+		if (ov->func == ov_gettimeofday)
+			gtod_ns = samples[n / 2];
+	}
+	free(samples);
+	if (g_perffd >= 0)
+		close(g_perffd);
+	if (g_statfd >= 0)
+		close(g_statfd);
+	return gtod_ns;
+}
+
+/*
+ * Host fingerprint, printed with every report so results from different
+ * hosts have provenance. Fixed size fields, so it can be stored as is.
+ */
+struct fingerprint {
+	char host[64];
+	char cpu[96];
+	char microcode[24];
+	char kernel[64];
+	char governor[24];
+	char smt[16];
+	char thp[16];
+	char mitigations[48];
+	char cgroup[64];
+	char virt[32];
+	char product[48];	// DMI product name, eg, cloud instance type
+	unsigned int ncpus;
+	unsigned int mem_mb;
+} g_fp;
+
+// value of the first "name : value" line in /proc/cpuinfo
+static void cpuinfo_field(const char *name, char *buf, int len)
+{
+	char line[4096], *p;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (strncmp(line, name, strlen(name)) != 0 ||
+		    (p = strchr(line, ':')) == NULL)
+			continue;
+		for (p++; *p == ' '; p++)
+			;
+		p[strcspn(p, "\n")] = '\0';
+		snprintf(buf, len, "%s", p);
+		break;
+	}
+	fclose(fp);
+}
+
+/*
+ * cgroup CPU and memory limits, from cgroup v2 (cpu.max, memory.max), or
+ * v1 (cpu.cfs_quota_us, memory.limit_in_bytes).
+ */
+static void cgroup_limits(char *buf, int len)
+{
+	char line[PATH_MAX], path[PATH_MAX + 64], cpu[32], mem[32];
+	char *cg, *v2 = NULL, *v1cpu = NULL, *v1mem = NULL;
+	unsigned long long period, limit;
+	long long quota;
+	FILE *fp;
+
+	strcpy(cpu, "max");
+	strcpy(mem, "max");
+	if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((cg = strrchr(line, ':')) == NULL)
+			continue;
+		if (strncmp(line, "0::", 3) == 0)
+			v2 = strdup(cg + 1);
+		else if (strstr(line, ":cpu,") || strstr(line, ":cpu:"))
+			v1cpu = strdup(cg + 1);
+		else if (strstr(line, ":memory:"))
+			v1mem = strdup(cg + 1);
+	}
+	fclose(fp);
+
+	if (v1cpu) {
+		snprintf(path, sizeof (path),
+		    "/sys/fs/cgroup/cpu/%s/cpu.cfs_quota_us", v1cpu);
+		// -1 is no limit
+		if (readfile_str(path, line, sizeof (line)) == 0 &&
+		    (quota = atoll(line)) > 0) {
+			snprintf(path, sizeof (path),
+			    "/sys/fs/cgroup/cpu/%s/cpu.cfs_period_us", v1cpu);
+			if (readfile_ull(path, &period) == 0 && period)
+				snprintf(cpu, sizeof (cpu), "%.2f",
+				    (double)quota / period);
+		}
+	} else if (v2) {
+		snprintf(path, sizeof (path), "/sys/fs/cgroup/%s/cpu.max", v2);
+		if (readfile_str(path, line, sizeof (line)) == 0 &&
+		    sscanf(line, "%lld %llu", &quota, &period) == 2 && period)
+			snprintf(cpu, sizeof (cpu), "%.2f",
+			    (double)quota / period);
+	}
+	if (v1mem) {
+		snprintf(path, sizeof (path),
+		    "/sys/fs/cgroup/memory/%s/memory.limit_in_bytes", v1mem);
+	} else if (v2) {
+		snprintf(path, sizeof (path), "/sys/fs/cgroup/%s/memory.max",
+		    v2);
+	}
+	// v1 reports "no limit" as a huge number
+	if ((v1mem || v2) && readfile_ull(path, &limit) == 0 &&
+	    limit < (1ULL << 60))
+		snprintf(mem, sizeof (mem), "%lluM", limit / (1024 * 1024));
+	snprintf(buf, len, "cpu %s, mem %s", cpu, mem);
+	free(v2);
+	free(v1cpu);
+	free(v1mem);
+}
+
+void fingerprint(struct fingerprint *fp)
+{
+	char buf[256], flags[4096], path[PATH_MAX];
+	struct utsname un;
+	struct dirent *de;
+	int vuln = 0, mitigated = 0;
+	char *p, *q;
+	DIR *dir;
+
+	memset(fp, 0, sizeof (*fp));
+	strcpy(fp->cpu, "-");
+	strcpy(fp->microcode, "-");
+	strcpy(fp->governor, "-");
+	strcpy(fp->smt, "-");
+	strcpy(fp->thp, "-");
+	strcpy(fp->mitigations, "-");
+	strcpy(fp->cgroup, "-");
+	strcpy(fp->virt, "none");
+	strcpy(fp->product, "-");
+
+	if (uname(&un) == 0) {
+		snprintf(fp->host, sizeof (fp->host), "%.63s", un.nodename);
+		snprintf(fp->kernel, sizeof (fp->kernel), "%.15s %.47s",
+		    un.sysname, un.release);
+	}
+	fp->ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef _SC_PHYS_PAGES
+	fp->mem_mb = (unsigned long long)sysconf(_SC_PHYS_PAGES) *
+	    sysconf(_SC_PAGESIZE) / (1024 * 1024);
+#endif
+
+	cpuinfo_field("model name", fp->cpu, sizeof (fp->cpu));
+	cpuinfo_field("microcode", fp->microcode, sizeof (fp->microcode));
+	readfile_str("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor",
+	    fp->governor, sizeof (fp->governor));
+	if (readfile_str("/sys/devices/system/cpu/smt/active", buf,
+	    sizeof (buf)) == 0)
+		strcpy(fp->smt, atoi(buf) ? "on" : "off");
+
+	// "always [madvise] never" -> "madvise"
+	if (readfile_str("/sys/kernel/mm/transparent_hugepage/enabled", buf,
+	    sizeof (buf)) == 0 && (p = strchr(buf, '[')) &&
+	    (q = strchr(p, ']'))) {
+		*q = '\0';
+		snprintf(fp->thp, sizeof (fp->thp), "%s", p + 1);
+	}
+
+	if ((dir = opendir("/sys/devices/system/cpu/vulnerabilities")) != NULL) {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof (path),
+			    "/sys/devices/system/cpu/vulnerabilities/%s",
+			    de->d_name);
+			if (readfile_str(path, buf, sizeof (buf)) != 0)
+				continue;
+			if (strncmp(buf, "Vulnerable", 10) == 0)
+				vuln++;
+			else if (strncmp(buf, "Mitigation", 10) == 0)
+				mitigated++;
+		}
+		closedir(dir);
+		snprintf(fp->mitigations, sizeof (fp->mitigations),
+		    "%d mitigated, %d vulnerable", mitigated, vuln);
+	}
+
+	cgroup_limits(fp->cgroup, sizeof (fp->cgroup));
+
+	if (readfile_str("/sys/hypervisor/type", buf, sizeof (buf)) == 0 ||
+	    readfile_str("/sys/class/dmi/id/sys_vendor", buf,
+	    sizeof (buf)) == 0) {
+		if (strstr(buf, "QEMU") || strstr(buf, "KVM") ||
+		    strstr(buf, "Amazon") || strstr(buf, "Google") ||
+		    strstr(buf, "Microsoft") || strstr(buf, "VMware") ||
+		    strstr(buf, "Xen") || strstr(buf, "xen"))
+			snprintf(fp->virt, sizeof (fp->virt), "%.31s", buf);
+	}
+	if (strcmp(fp->virt, "none") == 0) {
+		flags[0] = '\0';
+		cpuinfo_field("flags", flags, sizeof (flags));
+		if (strstr(flags, " hypervisor"))
+			strcpy(fp->virt, "hypervisor");
+	}
+	readfile_str("/sys/class/dmi/id/product_name", fp->product,
+	    sizeof (fp->product));
+}
+
+void print_fingerprint(struct fingerprint *fp)
+{
+	printf("Host: %s, %s, %u CPUs, %u Mbytes\n", fp->host, fp->kernel,
+	    fp->ncpus, fp->mem_mb);
+	printf("CPU: %s, microcode %s, governor %s, SMT %s\n", fp->cpu,
+	    fp->microcode, fp->governor, fp->smt);
+	printf("Config: THP %s, mitigations %s, cgroup %s, virt %s, "
+	    "product %s\n", fp->thp, fp->mitigations, fp->cgroup, fp->virt,
+	    fp->product);
+}
+
+/*
+ * Parses a CPU list such as "0-3,8" into a boolean array of ncpus.
+ * Returns the number of CPUs set.
+ */
+int parse_cpulist(const char *list, char *cpus, int ncpus)
+{
+	const char *p = list;
+	char *end;
+	int lo, hi, cpu, count = 0;
+
+	memset(cpus, 0, ncpus);
+	while (*p) {
+		lo = hi = strtol(p, &end, 10);
+		if (end == p)
+			break;
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for (cpu = lo; cpu <= hi && cpu < ncpus; cpu++) {
+			if (cpu >= 0 && !cpus[cpu]) {
+				cpus[cpu] = 1;
+				count++;
+			}
+		}
+		p = *end == ',' ? end + 1 : end;
+		if (*end != ',')
+			break;
+	}
+	return count;
+}
+
+/*
+ * Working set population. Pages are first touched by one thread per CPU,
+ * taking 64 Mbyte chunks in turn, so a multi-terabyte working set is
+ * ready in seconds rather than minutes. First-touch NUMA placement puts
+ * each chunk on its thread's node: when pinned (-c), the threads run on
+ * the benchmark CPU's node, so the working set is local until that node
+ * is full; otherwise they run on all allowed CPUs, spreading it over the
+ * nodes.
+ */
+#define POP_THREADS	256
+#define POP_CHUNK	(64ULL * 1024 * 1024)
+
+struct popthread {
+	pthread_t thread;
+	int cpu;
+};
+
+char *g_popmem;
+unsigned long long g_popsize, g_popnext, g_popdone;
+
+void *popthread(void *arg)
+{
+	struct popthread *pt = (struct popthread *)arg;
+	unsigned long long chunk, start, end;
+	long pagesize = getpagesize();
+	char *p;
+
+	if (pt->cpu >= 0)
+		(void) pin_cpu(pthread_self(), pt->cpu);
+	while ((chunk = __sync_fetch_and_add(&g_popnext, 1)) * POP_CHUNK <
+	    g_popsize) {
+		start = chunk * POP_CHUNK;
+		end = start + POP_CHUNK < g_popsize ? start + POP_CHUNK :
+		    g_popsize;
+		for (p = g_popmem + start; p < g_popmem + end; p += pagesize)
+			p[0] = 'A';
+		__sync_fetch_and_add(&g_popdone, end - start);
+	}
+	return NULL;
+}
+
+// CPUs to populate from: the pinned CPU's node, or all allowed CPUs
+static int pop_cpus(int pincpu, int *cpus, int max)
+{
+	char path[PATH_MAX], list[4096], *node, *allowed;
+	struct dirent *de;
+	DIR *dir;
+	int ncpus, i, n = 0;
+#ifdef __linux__
+	cpu_set_t set;
+#endif
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus < 1 || (node = calloc(ncpus, 2)) == NULL)
+		return 0;
+	allowed = node + ncpus;
+	memset(allowed, 1, ncpus);
+#ifdef __linux__
+	if (sched_getaffinity(0, sizeof (set), &set) == 0) {
+		for (i = 0; i < ncpus; i++)
+			allowed[i] = i < CPU_SETSIZE && CPU_ISSET(i, &set);
+	}
+#endif
+	if (pincpu >= 0 && pincpu < ncpus &&
+	    (dir = opendir("/sys/devices/system/node")) != NULL) {
+		while ((de = readdir(dir)) != NULL) {
+			if (strncmp(de->d_name, "node", 4) != 0 ||
+			    de->d_name[4] < '0' || de->d_name[4] > '9')
+				continue;
+			snprintf(path, sizeof (path),
+			    "/sys/devices/system/node/%s/cpulist", de->d_name);
+			if (readfile_str(path, list, sizeof (list)) == 0 &&
+			    parse_cpulist(list, node, ncpus) && node[pincpu]) {
+				for (i = 0; i < ncpus; i++)
+					allowed[i] &= node[i];
+				break;
+			}
+		}
+		closedir(dir);
+	}
+	for (i = 0; i < ncpus && n < max; i++) {
+		if (allowed[i])
+			cpus[n++] = i;
+	}
+	free(node);
+	return n;
+}
+
+// touches every page of mem in parallel, with progress. Returns 0 or -1.
+int populate(char *mem, unsigned long long size, int pincpu)
+{
+	struct popthread pt[POP_THREADS];
+	int cpus[POP_THREADS], n, i;
+	unsigned long long done, start_ns, last_ns;
+
+	g_popmem = mem;
+	g_popsize = size;
+	g_popnext = g_popdone = 0;
+	if ((n = pop_cpus(pincpu, cpus, POP_THREADS)) < 1) {
+		cpus[0] = -1;
+		n = 1;
+	}
+	if (n > size / POP_CHUNK + 1)
+		n = size / POP_CHUNK + 1;
+	for (i = 0; i < n; i++) {
+		pt[i].cpu = cpus[i];
+		if (pthread_create(&pt[i].thread, NULL, popthread, &pt[i]) !=
+		    0) {
+			if (i == 0) {
+				perror("Thread create failed");
+				return -1;
+			}
+			n = i;
+			break;
+		}
+	}
+	start_ns = last_ns = now_ns();
+	while ((done = __sync_fetch_and_add(&g_popdone, 0)) < size) {
+		usleep(10 * 1000);
+		if (now_ns() - last_ns < 1000000000ULL)
+			continue;
+		last_ns = now_ns();
+		printf("\rPopulating %llu/%llu Mbytes with %d thread%s "
+		    "(%.0f%%)  ", done / (1024 * 1024), size / (1024 * 1024), n,
+		    n == 1 ? "" : "s", (double)100 * done / size);
+		fflush(stdout);
+	}
+	for (i = 0; i < n; i++)
+		pthread_join(pt[i].thread, NULL);
+	printf("\rPopulated %llu Mbytes with %d thread%s in %.2f s%20s\n",
+	    size / (1024 * 1024), n, n == 1 ? "" : "s",
+	    (double)(now_ns() - start_ns) / 1e9, "");
+	return 0;
+}
+
+/*
+ * Pre-flight checks (-p): host configuration that commonly causes slow or
+ * noisy histograms, checked before the test. Impact estimates are rough
+ * guides from typical hosts, not measurements.
+ */
+static int g_preflight_warnings;
+
+static void pf_ok(const char *check, const char *detail)
+{
+	printf("  OK    %-16s %s\n", check, detail);
+}
+
+static void pf_warn(const char *check, const char *detail,
+    const char *impact)
+{
+	printf("  WARN  %-16s %s\n%24s impact: %s\n", check, detail, "",
+	    impact);
+	g_preflight_warnings++;
+}
+
+// processes using more than 5% of a CPU over a short sample
+static void pf_busy_procs(void)
+{
+	struct proc {
+		int pid;
+		unsigned long long ticks;
+		char comm[32];
+	} *procs = NULL, *tmp;
+	int nprocs = 0, i, found = 0, pid;
+	unsigned long long ticks, utime, stime;
+	char path[64], line[1024], detail[256], *p;
+	struct dirent *de;
+	long hz = sysconf(_SC_CLK_TCK);
+	int pass;
+	DIR *dir;
+	FILE *fp;
+
+	detail[0] = '\0';
+	for (pass = 0; pass < 2; pass++) {
+		if ((dir = opendir("/proc")) == NULL) {
+			free(procs);
+			return;
+		}
+		while ((de = readdir(dir)) != NULL) {
+			if ((pid = atoi(de->d_name)) <= 0 || pid == getpid())
+				continue;
+			snprintf(path, sizeof (path), "/proc/%d/stat", pid);
+			if ((fp = fopen(path, "r")) == NULL)
+				continue;
+			p = fgets(line, sizeof (line), fp);
+			fclose(fp);
+			// fields after the ")" of comm: state is field 3
+			if (p == NULL || (p = strrchr(line, ')')) == NULL ||
+			    sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u "
+			    "%*u %*u %*u %llu %llu", &utime, &stime) != 2)
+				continue;
+			ticks = utime + stime;
+			if (pass == 0) {
+				if ((tmp = realloc(procs, (nprocs + 1) *
+				    sizeof (*procs))) == NULL) {
+					closedir(dir);
+					free(procs);
+					return;
+				}
+				procs = tmp;
+				procs[nprocs].pid = pid;
+				procs[nprocs].ticks = ticks;
+				*p = '\0';
+				snprintf(procs[nprocs].comm,
+				    sizeof (procs[nprocs].comm), "%s",
+				    strchr(line, '(') + 1);
+				nprocs++;
+				continue;
+			}
+			for (i = 0; i < nprocs; i++) {
+				if (procs[i].pid != pid)
+					continue;
+				// 500 ms sample: 5% is hz / 40 ticks
+				if ((ticks - procs[i].ticks) * 40 > hz &&
+				    strlen(detail) < sizeof (detail) - 48) {
+					snprintf(detail + strlen(detail),
+					    sizeof (detail) - strlen(detail),
+					    "%s%s(%d) %llu%%", found ? ", " : "",
+					    procs[i].comm, pid,
+					    (ticks - procs[i].ticks) * 200 / hz);
+					found++;
+				}
+				break;
+			}
+		}
+		closedir(dir);
+		if (pass == 0)
+			usleep(500 * 1000);
+	}
+	free(procs);
+	if (found)
+		pf_warn("busy processes", detail, "competes for CPU, caches "
+		    "and memory bandwidth; can add 1-100%+");
+	else
+		pf_ok("busy processes", "none over 5% CPU");
+}
+
+void preflight(int cpu)
+{
+	char path[PATH_MAX], buf[256], detail[512], list[4096], gov[256];
+	char *cpus, *isol;
+	int ncpus, i, n, nirq, bad;
+	unsigned long long val, total, avail;
+	struct dirent *de;
+	DIR *dir;
+	FILE *fp;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if ((cpus = malloc(ncpus)) == NULL || (isol = malloc(ncpus)) == NULL)
+		return;
+	g_preflight_warnings = 0;
+	printf("Pre-flight checks%s:\n", cpu >= 0 ? "" :
+	    " (not pinned: use -c cpu for per-CPU checks)");
+
+	// cpufreq governor, keeping the first one that isn't performance
+	bad = n = 0;
+	gov[0] = '\0';
+	for (i = 0; i < ncpus; i++) {
+		if (cpu >= 0 && i != cpu)
+			continue;
+		snprintf(path, sizeof (path),
+		    "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", i);
+		if (readfile_str(path, buf, sizeof (buf)) != 0)
+			continue;
+		n++;
+		if (strcmp(buf, "performance") != 0 && !bad++)
+			snprintf(gov, sizeof (gov), "%s", buf);
+	}
+	if (!n) {
+		pf_ok("governor", "no cpufreq (fixed frequency or VM)");
+	} else if (bad) {
+		snprintf(detail, sizeof (detail), "%d of %d CPUs not using the "
+		    "performance governor (%s)", bad, n, gov);
+		pf_warn("governor", detail, "frequency ramps between runs; "
+		    "5-50% variance, slow first runs");
+	} else {
+		pf_ok("governor", "performance");
+	}
+
+	// turbo/boost
+	if (readfile_ull("/sys/devices/system/cpu/intel_pstate/no_turbo",
+	    &val) == 0)
+		val = !val;
+	else if (readfile_ull("/sys/devices/system/cpu/cpufreq/boost",
+	    &val) != 0)
+		val = 2;
+	if (val == 1)
+		pf_warn("turbo", "turbo/boost enabled", "clock varies with "
+		    "thermal and power headroom and other busy cores; 5-20%");
+	else
+		pf_ok("turbo", val ? "unknown (no control exposed)" :
+		    "disabled");
+
+	// C-states: deep states add wakeup latency after idle
+	detail[0] = '\0';
+	for (i = 0; ; i++) {
+		snprintf(path, sizeof (path),
+		    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/latency",
+		    cpu >= 0 ? cpu : 0, i);
+		if (readfile_ull(path, &val) != 0)
+			break;
+		snprintf(path, sizeof (path),
+		    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/disable",
+		    cpu >= 0 ? cpu : 0, i);
+		if (readfile_ull(path, &total) == 0 && total)
+			continue;
+		if (val >= 50) {
+			snprintf(path, sizeof (path),
+			    "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/name",
+			    cpu >= 0 ? cpu : 0, i);
+			readfile_str(path, buf, sizeof (buf));
+			snprintf(detail + strlen(detail),
+			    sizeof (detail) - strlen(detail), "%s%s (%llu us)",
+			    detail[0] ? ", " : "", buf, val);
+		}
+	}
+	if (readfile_str("/sys/module/intel_idle/parameters/max_cstate", buf,
+	    sizeof (buf)) == 0 && strlen(detail) < sizeof (detail) - 32)
+		snprintf(detail + strlen(detail), sizeof (detail) -
+		    strlen(detail), "%sintel_idle.max_cstate=%s",
+		    detail[0] ? ", " : "", buf);
+	if (detail[0] && strstr(detail, " us)"))
+		pf_warn("C-states", detail, "wakeup exit latency hits short "
+		    "runs and IPC/network modes; 1-10%");
+	else
+		pf_ok("C-states", "no deep idle states enabled");
+
+	// isolation
+	n = 0;
+	memset(isol, 0, ncpus);
+	if (readfile_str("/sys/devices/system/cpu/isolated", list,
+	    sizeof (list)) == 0)
+		n = parse_cpulist(list, isol, ncpus);
+	if (readfile_str("/sys/devices/system/cpu/nohz_full", buf,
+	    sizeof (buf)) != 0 || !buf[0])
+		strcpy(buf, "none");
+	if (cpu >= 0 && cpu < ncpus && !isol[cpu]) {
+		snprintf(detail, sizeof (detail), "CPU %d is not in isolcpus "
+		    "(isolated: %.200s, nohz_full: %.200s)", cpu,
+		    n ? list : "none", buf);
+		pf_warn("isolation", detail, "scheduler may place other tasks "
+		    "on the benchmark CPU; 0-100%");
+	} else if (cpu >= 0) {
+		snprintf(detail, sizeof (detail), "CPU %d isolated", cpu);
+		pf_ok("isolation", detail);
+	} else {
+		snprintf(detail, sizeof (detail), "isolated: %.200s, "
+		    "nohz_full: %.200s", n ? list : "none", buf);
+		pf_ok("isolation", detail);
+	}
+
+	// IRQ affinity
+	nirq = bad = 0;
+	if ((dir = opendir("/proc/irq")) != NULL) {
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] < '0' || de->d_name[0] > '9')
+				continue;
+			snprintf(path, sizeof (path),
+			    "/proc/irq/%s/smp_affinity_list", de->d_name);
+			if (readfile_str(path, list, sizeof (list)) != 0)
+				continue;
+			nirq++;
+			if (cpu >= 0 && cpu < ncpus &&
+			    parse_cpulist(list, cpus, ncpus) &&
+			    cpus[cpu])
+				bad++;
+		}
+		closedir(dir);
+	}
+	if (cpu < 0) {
+		pf_ok("IRQ affinity", "not pinned, not checked");
+	} else if (bad) {
+		snprintf(detail, sizeof (detail), "%d of %d IRQs may be "
+		    "delivered to CPU %d", bad, nirq, cpu);
+		pf_warn("IRQ affinity", detail, "interrupt and softirq time "
+		    "lands in runs; 0.1-5%");
+	} else {
+		snprintf(detail, sizeof (detail), "no IRQs routed to CPU %d",
+		    cpu);
+		pf_ok("IRQ affinity", detail);
+	}
+
+	// THP
+	if (readfile_str("/sys/kernel/mm/transparent_hugepage/enabled", buf,
+	    sizeof (buf)) != 0)
+		buf[0] = '\0';
+	if (strstr(buf, "[always]"))
+		pf_warn("THP", "transparent huge pages: always", "khugepaged "
+		    "collapses and compaction stalls in -m tests; 0-20%");
+	else
+		pf_ok("THP", buf[0] ? buf : "not available");
+
+	// NUMA balancing
+	if (readfile_ull("/proc/sys/kernel/numa_balancing", &val) != 0)
+		pf_ok("NUMA balancing", "-");
+	else if (val)
+		pf_warn("NUMA balancing", "automatic NUMA balancing enabled",
+		    "hinting faults and page migration during -m tests; 1-10%");
+	else
+		pf_ok("NUMA balancing", "disabled");
+
+	// swap in use
+	total = avail = 0;
+	if ((fp = fopen("/proc/meminfo", "r")) != NULL) {
+		while (fgets(buf, sizeof (buf), fp) != NULL) {
+			sscanf(buf, "SwapTotal: %llu", &total);
+			sscanf(buf, "SwapFree: %llu", &avail);
+		}
+		fclose(fp);
+	}
+	if (total - avail > 0) {
+		snprintf(detail, sizeof (detail), "%llu Mbytes of swap in use",
+		    (total - avail) / 1024);
+		pf_warn("swap", detail, "memory pressure; major faults and "
+		    "reclaim can add 10-1000%");
+	} else {
+		pf_ok("swap", total ? "none in use" : "no swap");
+	}
+
+	pf_busy_procs();
+
+	if (g_preflight_warnings)
+		printf("%d warning(s): results may reflect host "
+		    "configuration rather than transient noise.\n\n",
+		    g_preflight_warnings);
+	else
+		printf("No warnings.\n\n");
+	free(cpus);
+	free(isol);
+}
+
+/*
+ * Isolated CPU validation (-I): runs a gap-detecting spin loop on each
+ * isolated (isolcpus or nohz_full) CPU, or the -c CPU, and counts what
+ * still interrupts it: local timer ticks, IRQs and softirqs from
+ * /proc/interrupts and /proc/softirqs, and kernel thread runs from
+ * /proc/PID/schedstat.
+ */
+#define GAP_NS	1000	// clock read gaps above this are interruptions
+
+struct gapstat {
+	unsigned long long gaps;
+	unsigned long long lost_ns;
+	unsigned long long max_ns;
+};
+
+/*
+ * Reads the clock continuously for target_us. Any gap between reads over
+ * GAP_NS is time the CPU was taken away from this thread.
+ */
+void gapspin(unsigned long long target_us, struct gapstat *gs)
+{
+	unsigned long long start, last, now, gap;
+
+	start = last = now_ns();
+	while ((now = now_ns()) - start < target_us * 1000) {
+		gap = now - last;
+		if (gap > GAP_NS) {
+			gs->gaps++;
+			gs->lost_ns += gap;
+			if (gap > gs->max_ns)
+				gs->max_ns = gap;
+		}
+		last = now;
+	}
+}
+
+struct cpucounts {
+	unsigned long long loc;		// local timer interrupts
+	unsigned long long irqs;	// all interrupts
+	unsigned long long softirqs;
+	unsigned long long rcu;		// RCU softirqs
+	unsigned long long kworker;	// kernel thread timeslices, as deltas
+	unsigned long long krcu;
+	unsigned long long kother;
+};
+
+#define KT_WORKER	0
+#define KT_RCU		1
+#define KT_OTHER	2
+
+struct kthread {
+	int pid;
+	int kind;
+	unsigned long long runs;
+};
+
+/*
+ * Sums one CPU's column of a /proc/interrupts style table, and returns
+ * the value of the named row separately.
+ */
+static void proc_cpu_table(const char *path, int cpu, const char *row,
+    unsigned long long *rowval, unsigned long long *total)
+{
+	char line[8192], name[32], *p, *end;
+	int col = -1, i;
+	unsigned long long val;
+	FILE *fp;
+
+	*rowval = *total = 0;
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	// header: "CPU0 CPU1 ...", which may skip offline CPUs
+	if (fgets(line, sizeof (line), fp) != NULL) {
+		for (i = 0, p = strtok(line, " \t\n"); p != NULL;
+		    i++, p = strtok(NULL, " \t\n")) {
+			if (strncmp(p, "CPU", 3) == 0 && atoi(p + 3) == cpu)
+				col = i;
+		}
+	}
+	while (col >= 0 && fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, " %31[^:]:", name) != 1 ||
+		    (p = strchr(line, ':')) == NULL)
+			continue;
+		p++;
+		for (i = 0; i <= col; i++) {
+			val = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		if (i <= col)
+			continue;	// row without per-CPU counts (ERR, MIS)
+		*total += val;
+		if (strcmp(name, row) == 0)
+			*rowval = val;
+	}
+	fclose(fp);
+}
+
+// reads a thread's timeslice count. Returns -1 if it has gone.
+static int kthread_read(int pid, unsigned long long *runs)
+{
+	char path[64];
+	FILE *fp;
+	int ret;
+
+	snprintf(path, sizeof (path), "/proc/%d/schedstat", pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	ret = fscanf(fp, "%*u %*u %llu", runs) == 1 ? 0 : -1;
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * Kernel threads last seen on this CPU, with their timeslice counts.
+ * Returns the count.
+ */
+static int kthread_snap(int cpu, struct kthread **kt, int *alloc)
+{
+	char path[64], line[1024], *comm, *p;
+	struct dirent *de;
+	struct kthread *t;
+	int pid, ppid, field, last_cpu, n = 0;
+	DIR *dir;
+
+	if ((dir = opendir("/proc")) == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if ((pid = atoi(de->d_name)) <= 0)
+			continue;
+		snprintf(path, sizeof (path), "/proc/%d/stat", pid);
+		if (readfile_str(path, line, sizeof (line)) != 0 ||
+		    (p = strrchr(line, ')')) == NULL)
+			continue;
+		*p = '\0';
+		comm = strchr(line, '(') + 1;
+		// fields from state (3): ppid is 4, processor is 39
+		ppid = last_cpu = -1;
+		for (field = 3, p = strtok(p + 2, " "); p != NULL;
+		    field++, p = strtok(NULL, " ")) {
+			if (field == 4)
+				ppid = atoi(p);
+			if (field == 39) {
+				last_cpu = atoi(p);
+				break;
+			}
+		}
+		if ((ppid != 2 && pid != 2) || last_cpu != cpu)
+			continue;
+		if (n == *alloc) {
+			*alloc = *alloc ? *alloc * 2 : 256;
+			if ((*kt = realloc(*kt, *alloc *
+			    sizeof (struct kthread))) == NULL) {
+				printf("ERROR: can't allocate kernel thread "
+				    "list\n");
+				exit(1);
+			}
+		}
+		t = &(*kt)[n];
+		t->pid = pid;
+		t->kind = strncmp(comm, "kworker", 7) == 0 ? KT_WORKER :
+		    strncmp(comm, "rcu", 3) == 0 ? KT_RCU : KT_OTHER;
+		if (kthread_read(pid, &t->runs) == 0)
+			n++;
+	}
+	closedir(dir);
+	return n;
+}
+
+/*
+ * Timeslices since kthread_snap(), per thread, so threads that migrate
+ * away still count. Threads that have exited are skipped.
+ */
+static void kthread_delta(struct kthread *kt, int n, struct cpucounts *cc)
+{
+	unsigned long long runs, *sums[3];
+	int i;
+
+	sums[KT_WORKER] = &cc->kworker;
+	sums[KT_RCU] = &cc->krcu;
+	sums[KT_OTHER] = &cc->kother;
+	cc->kworker = cc->krcu = cc->kother = 0;
+	for (i = 0; i < n; i++) {
+		if (kthread_read(kt[i].pid, &runs) == 0 && runs >= kt[i].runs)
+			*sums[kt[i].kind] += runs - kt[i].runs;
+	}
+}
+
+static void cpu_counts(int cpu, struct cpucounts *cc)
+{
+	proc_cpu_table("/proc/interrupts", cpu, "LOC", &cc->loc, &cc->irqs);
+	proc_cpu_table("/proc/softirqs", cpu, "RCU", &cc->rcu, &cc->softirqs);
+}
+
+int isolation_check(unsigned long long target_us, int max_runs, int pincpu)
+{
+	struct cpucounts cc[2];
+	struct gapstat gs, total;
+	struct kthread *kt = NULL;
+	char list[4096], *cpus, *nohz;
+	double *runs_pct, secs, lost_pct, tick_rate;
+	int ncpus, cpu, i, n, nkt, ktalloc = 0, checked = 0;
+	const char *quality;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	cpus = malloc(ncpus);
+	nohz = malloc(ncpus);
+	runs_pct = malloc(max_runs * sizeof (double));
+	if (cpus == NULL || nohz == NULL || runs_pct == NULL) {
+		printf("ERROR: can't allocate memory for %d runs\n", max_runs);
+		goto out;
+	}
+	n = 0;
+	memset(cpus, 0, ncpus);
+	if (pincpu >= 0) {
+		if (pincpu < ncpus)
+			cpus[pincpu] = n = 1;
+	} else {
+		if (readfile_str("/sys/devices/system/cpu/isolated", list,
+		    sizeof (list)) == 0)
+			n = parse_cpulist(list, cpus, ncpus);
+		if (readfile_str("/sys/devices/system/cpu/nohz_full", list,
+		    sizeof (list)) == 0 && parse_cpulist(list, nohz, ncpus)) {
+			for (i = 0; i < ncpus; i++) {
+				if (nohz[i] && !cpus[i]) {
+					cpus[i] = 1;
+					n++;
+				}
+			}
+		}
+	}
+	if (!n) {
+		printf("ERROR: no isolated or nohz_full CPUs; use -c cpu to "
+		    "check one\n");
+		goto out;
+	}
+
+	signal(SIGINT, mainstop);
+	for (cpu = 0; cpu < ncpus && g_mainrun; cpu++) {
+		if (!cpus[cpu])
+			continue;
+		if (pin_cpu(pthread_self(), cpu) != 0) {
+			printf("ERROR: couldn't pin to CPU %d\n", cpu);
+			continue;
+		}
+		printf("\nChecking CPU %d isolation, %d runs of %llu ms...\n",
+		    cpu, max_runs, target_us / 1000);
+		fflush(stdout);
+		memset(&total, 0, sizeof (total));
+		cpu_counts(cpu, &cc[0]);
+		nkt = kthread_snap(cpu, &kt, &ktalloc);
+		for (i = 0; i < max_runs && g_mainrun; i++) {
+			memset(&gs, 0, sizeof (gs));
+			gapspin(target_us, &gs);
+			runs_pct[i] = (double)gs.lost_ns / (target_us * 10);
+			total.gaps += gs.gaps;
+			total.lost_ns += gs.lost_ns;
+			if (gs.max_ns > total.max_ns)
+				total.max_ns = gs.max_ns;
+		}
+		cpu_counts(cpu, &cc[1]);
+		kthread_delta(kt, nkt, &cc[1]);
+		if (!i)
+			break;
+
+		secs = (double)i * target_us / 1000000;
+		lost_pct = (double)total.lost_ns / (secs * 10000000);
+		tick_rate = (cc[1].loc - cc[0].loc) / secs;
+		quality = lost_pct < 0.01 && tick_rate <= 2 ? "good" :
+		    lost_pct < 1 ? "fair" : "poor";
+		printf("\nPercent of run time lost to interruptions (>%d ns) "
+		    "by count:\n", GAP_NS);
+		print_hist(runs_pct, i);
+		printf("CPU %d: %llu gaps (%.1f/s), %.4f%% lost, max gap %llu "
+		    "us\n", cpu, total.gaps, total.gaps / secs, lost_pct,
+		    total.max_ns / 1000);
+		printf("CPU %d: timer ticks %llu (%.1f/s), IRQs %llu, softirqs "
+		    "%llu (RCU %llu)\n", cpu, cc[1].loc - cc[0].loc, tick_rate,
+		    cc[1].irqs - cc[0].irqs, cc[1].softirqs - cc[0].softirqs,
+		    cc[1].rcu - cc[0].rcu);
+		printf("CPU %d: kernel thread runs: kworker %llu, rcu %llu, "
+		    "other %llu\n", cpu, cc[1].kworker, cc[1].krcu,
+		    cc[1].kother);
+		printf("CPU %d: isolation %s\n", cpu, quality);
+		checked++;
+	}
+
+out:
+	free(cpus);
+	free(nohz);
+	free(runs_pct);
+	free(kt);
+	return checked ? 0 : 1;
+}
+
+/*
+ * Matrix runner: runs every combination of the comma separated target
+ * times, -m sizes (0 for the CPU spin loop) and -w memory types, each with
+ * its own calibration, then prints one table. With -x the runs are
+ * interleaved round-robin across configurations, so that noise during the
+ * test is spread fairly between them instead of landing on whichever
+ * configuration ran at that time. With a sweep_pct (-D), the durations are
+ * a 1-2-5 series and it also reports how perturbation shrinks with run
+ * length, and the shortest run that stays within sweep_pct.
+ */
+#define MATRIX_MAX	64	// values per list
+
+struct mconfig {
+	char name[64];
+	unsigned long long target_us;
+	unsigned long long memsize;	// 0 for spin
+	struct memtype *memtype;
+	unsigned long long iter_count;
+	unsigned long long *runs_ns;	// ns, as -D sweeps from 100us
+	int runs;
+};
+
+// parses "a,b,c" into vals, times mult. Returns the count, or -1.
+int parse_ull_list(char *str, unsigned long long *vals,
+    unsigned long long mult)
+{
+	char *p, *save;
+	int n = 0;
+
+	for (p = strtok_r(str, ",", &save); p != NULL;
+	    p = strtok_r(NULL, ",", &save)) {
+		if (n == MATRIX_MAX)
+			return -1;
+		vals[n++] = strtoull(p, NULL, 10) * mult;
+	}
+	return n;
+}
+
+/*
+ * Parses a size in Mbytes, or with a K, M, G or T suffix (powers of 1024,
+ * optionally followed by B). Returns -1 if invalid or over 64 bits.
+ */
+int parse_size(const char *str, unsigned long long *bytes)
+{
+	unsigned long long val, mult = 1024 * 1024;
+	const char *units = "KMGT", *u;
+	char *end;
+
+	if (strchr(str, '-') != NULL)
+		return -1;
+	errno = 0;
+	val = strtoull(str, &end, 10);
+	if (end == str || errno)
+		return -1;
+	if (*end && (u = strchr(units, toupper(*end))) != NULL) {
+		mult = 1ULL << (10 * (u - units + 1));
+		end++;
+		if (*end == 'B' || *end == 'b')
+			end++;
+	}
+	if (*end || (val && mult > ~0ULL / val))
+		return -1;
+	*bytes = val * mult;
+	return 0;
+}
+
+// comma-separated sizes, as for parse_ull_list; -1 if any is invalid
+int parse_size_list(char *str, unsigned long long *vals)
+{
+	char *p, *save;
+	int n = 0;
+
+	for (p = strtok_r(str, ",", &save); p != NULL;
+	    p = strtok_r(NULL, ",", &save)) {
+		if (n == MATRIX_MAX || parse_size(p, &vals[n++]) != 0)
+			return -1;
+	}
+	return n;
+}
+
+// percent slower than fastest for a percentile, or -1 if too few runs
+static double pctile_pct(unsigned long long *sorted, int runs, int pct)
+{
+	int min_runs = pct <= 50 ? 3 : pct <= 90 ? 10 : 100;
+
+	if (runs < min_runs)
+		return -1;
+	return (double)100 * (sorted[runs * pct / 100 - 1] - sorted[0]) /
+	    sorted[0];
+}
+
+/*
+ * Prints the percentiles line for sorted run times, skipping percentiles
+ * that need more runs than there are.
+ */
+void print_percentiles(unsigned long long *runs_us, int runs)
+{
+	printf("\nPercentiles:");
+	if (runs >= 3)
+		printf(" 50th: %.3f%%", pctile_pct(runs_us, runs, 50));
+	if (runs >= 10)
+		printf(", 90th: %.3f%%", pctile_pct(runs_us, runs, 90));
+	if (runs >= 100)
+		printf(", 99th: %.3f%%", pctile_pct(runs_us, runs, 99));
+	if (runs >= 3)
+		printf(",");
+	printf(" 100th: %.3f%%\n", (double)100 *
+	    (runs_us[runs - 1] - runs_us[0]) / runs_us[0]);
+}
+
+/*
+ * Makes mc the current configuration. Working sets that need preparing
+ * (chase) are prepared again whenever the size or type has changed since
+ * the last run, as other types may have written over them; durations
+ * share the prepared set.
+ */
+static void matrix_prep(struct mconfig *mc)
+{
+	static unsigned long long last_size;
+	static struct memtype *last_type;
+
+	g_memsize = mc->memsize;
+	g_memtype = mc->memtype;
+	// the spin loop leaves the working set alone
+	if (!mc->memsize)
+		return;
+	if (g_memtype->init && (mc->memsize != last_size ||
+	    mc->memtype != last_type))
+		g_memtype->init(g_mem, g_memsize);
+	last_size = mc->memsize;
+	last_type = mc->memtype;
+}
+
+static void matrix_once(struct mconfig *mc)
+{
+	unsigned long long start;
+
+	matrix_prep(mc);
+	start = now_ns();
+	(void) (mc->memsize ? memrun : spinrun)(mc->iter_count);
+	mc->runs_ns[mc->runs++] = now_ns() - start;
+}
+
+int matrix_run(unsigned long long *durations, int ndurations,
+    unsigned long long *sizes, int nsizes, struct memtype **types,
+    int ntypes, int max_runs, int interleave, int test_us, int test_runs,
+    double sweep_pct)
+{
+	struct mconfig *mcs, *mc;
+	unsigned long long maxsize = 0;
+	int nmcs = 0, d, m, t, i, r, per, best, pctile;
+	double maxpct;
+	double pct[4];
+	const int pcts[] = { 50, 90, 99 };
+
+	if ((mcs = calloc(ndurations * nsizes * ntypes,
+	    sizeof (struct mconfig))) == NULL)
+		return 1;
+	for (d = 0; d < ndurations; d++) {
+		for (m = 0; m < nsizes; m++) {
+			for (t = 0; t < ntypes; t++) {
+				// the spin loop has no memory type
+				if (!sizes[m] && t > 0)
+					continue;
+				mc = &mcs[nmcs++];
+				mc->target_us = durations[d];
+				mc->memsize = sizes[m];
+				mc->memtype = types[t];
+				if (sizes[m])
+					snprintf(mc->name, sizeof (mc->name),
+					    "mem %lluM %s %gms",
+					    sizes[m] / (1024 * 1024),
+					    types[t]->name,
+					    (double)durations[d] / 1000);
+				else
+					snprintf(mc->name, sizeof (mc->name),
+					    "spin %gms",
+					    (double)durations[d] / 1000);
+				if ((mc->runs_ns = malloc(max_runs *
+				    sizeof (unsigned long long))) == NULL)
+					return 1;
+				if (sizes[m] > maxsize)
+					maxsize = sizes[m];
+			}
+		}
+	}
+
+	// one working set, used from the start by each size
+	if (maxsize) {
+		printf("Allocating %llu Mbytes...\n", maxsize / (1024 * 1024));
+		if ((g_mem = malloc(maxsize)) == NULL) {
+			printf("ERROR allocating -m memory. Exiting.\n");
+			return 1;
+		}
+		if (populate(g_mem, maxsize, g_pincpu[0]) != 0)
+			return 1;
+	}
+
+	for (i = 0; i < nmcs; i++) {
+		mc = &mcs[i];
+		printf("\rCalibrating %d/%d: %-32s", i + 1, nmcs, mc->name);
+		fflush(stdout);
+		matrix_prep(mc);
+		mc->iter_count = find_count(mc->target_us, test_us, test_runs,
+		    mc->memsize ? g_memtype->test : spintest,
+		    mc->memsize ? memrun : spinrun);
+	}
+	printf("\n");
+
+	signal(SIGINT, mainstop);
+	if (interleave) {
+		for (r = 0; r < max_runs && g_mainrun; r++) {
+			printf("\rRound %d/%d (interleaved), Ctrl-C to stop  ",
+			    r + 1, max_runs);
+			fflush(stdout);
+			for (i = 0; i < nmcs && g_mainrun; i++)
+				matrix_once(&mcs[i]);
+		}
+	} else {
+		for (i = 0; i < nmcs && g_mainrun; i++) {
+			for (r = 0; r < max_runs && g_mainrun; r++) {
+				printf("\rConfig %d/%d, run %d/%d, Ctrl-C to "
+				    "stop  ", i + 1, nmcs, r + 1, max_runs);
+				fflush(stdout);
+				matrix_once(&mcs[i]);
+			}
+		}
+	}
+
+	printf("\n\nPerturbation percent by configuration%s:\n",
+	    interleave ? " (interleaved runs)" : "");
+	printf("%-28s %5s %11s %8s %8s %8s %8s %10s\n", "CONFIG", "RUNS",
+	    "FASTEST(ms)", "50th%", "90th%", "99th%", "100th%", "SCORE(M/s)");
+	for (i = 0; i < nmcs; i++) {
+		mc = &mcs[i];
+		printf("%-28s %5d ", mc->name, mc->runs);
+		if (!mc->runs) {
+			printf("%11s\n", "-");
+			continue;
+		}
+		qsort(mc->runs_ns, mc->runs, sizeof (unsigned long long),
+		    ullcmp);
+		for (t = 0; t < 3; t++)
+			pct[t] = pctile_pct(mc->runs_ns, mc->runs, pcts[t]);
+		pct[3] = (double)100 * (mc->runs_ns[mc->runs - 1] -
+		    mc->runs_ns[0]) / mc->runs_ns[0];
+		printf("%11.3f", (double)mc->runs_ns[0] / 1000000);
+		for (t = 0; t < 4; t++) {
+			if (pct[t] < 0)
+				printf(" %8s", "-");
+			else
+				printf(" %8.3f", pct[t]);
+		}
+		// as in the main report: rate of the 99th/90th/50th run
+		t = mc->runs >= 100 ? 99 : mc->runs >= 10 ? 90 : 50;
+		r = mc->runs * t / 100 - 1;
+		printf(" %10.2f\n", r < 0 ? 0 :
+		    (double)mc->iter_count * 1000 / mc->runs_ns[r]);
+	}
+	if (!sweep_pct)
+		return 0;
+
+	/*
+	 * Duration sweep. Configurations are ordered by duration, then size,
+	 * then type, so each size and type has one entry every per configs.
+	 * The recommendation is the shortest duration where this and every
+	 * longer duration were within sweep_pct.
+	 */
+	pctile = max_runs >= 100 ? 99 : max_runs >= 10 ? 90 : 50;
+	per = nmcs / ndurations;
+	for (i = 0; i < per; i++) {
+		maxpct = 0;
+		for (d = 0; d < ndurations; d++) {
+			mc = &mcs[d * per + i];
+			if (mc->runs && pctile_pct(mc->runs_ns, mc->runs,
+			    pctile) > maxpct)
+				maxpct = pctile_pct(mc->runs_ns, mc->runs,
+				    pctile);
+		}
+		printf("\n%dth percentile perturbation by run duration, %s:\n",
+		    pctile, mcs[i].memsize ? "memory" : "spin");
+		if (mcs[i].memsize)
+			printf("(%lluM %s)\n", mcs[i].memsize / (1024 * 1024),
+			    mcs[i].memtype->name);
+		printf("%12s %9s Perturbation\n", "Duration", "Slower%");
+		best = -1;
+		for (d = 0; d < ndurations; d++) {
+			mc = &mcs[d * per + i];
+			if (!mc->runs ||
+			    pctile_pct(mc->runs_ns, mc->runs, pctile) < 0) {
+				printf("%10gms %9s\n",
+				    (double)mc->target_us / 1000, "-");
+				best = -1;
+				continue;
+			}
+			pct[0] = pctile_pct(mc->runs_ns, mc->runs, pctile);
+			printf("%10gms %8.3f%% ", (double)mc->target_us / 1000,
+			    pct[0]);
+			for (r = 0; maxpct > 0 && r < myceil(50 * pct[0] /
+			    maxpct); r++)
+				printf("*");
+			printf("\n");
+			if (pct[0] > sweep_pct)
+				best = -1;
+			else if (best < 0)
+				best = d;
+		}
+		if (best < 0)
+			printf("No tested duration was within %g%%; try longer "
+			    "than %gms.\n", sweep_pct,
+			    (double)durations[ndurations - 1] / 1000);
+		else
+			printf("Minimum run duration for %dth percentile within "
+			    "%g%%: %gms\n", pctile, sweep_pct,
+			    (double)durations[best] / 1000);
+	}
+	return 0;
+}
+
+/*
+ * Power analysis (-e): how many repetitions a downstream benchmark with
+ * this perturbation needs to detect a slowdown. For each candidate count n
+ * it bootstraps pairs of n-run samples from the measured run times and
+ * compares their medians. Unchanged pairs give the threshold a difference
+ * must exceed at the chosen confidence, and pairs with one side slowed by
+ * the effect give the power: the fraction that exceeded it.
+ */
+#define POWER_RESAMPLES	400
+#define POWER_TARGET	0.8	// power required
+#define POWER_MAXN	1024
+
+static double sample_median(unsigned long long *runs_us, int runs,
+    double *buf, int n, unsigned int *seed)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		buf[i] = runs_us[rand_r(seed) % runs];
+	qsort(buf, n, sizeof (double), doublecmp);
+	return n % 2 ? buf[n / 2] : (buf[n / 2 - 1] + buf[n / 2]) / 2;
+}
+
+static double power_at(unsigned long long *runs_us, int runs, double effect,
+    double conf, int n, double *buf, double *diffs)
+{
+	unsigned int seed = 1;	// repeatable
+	double a, b, threshold;
+	int i, detected = 0;
+
+	for (i = 0; i < POWER_RESAMPLES; i++) {
+		a = sample_median(runs_us, runs, buf, n, &seed);
+		b = sample_median(runs_us, runs, buf, n, &seed);
+		diffs[i] = (b - a) / a;
+	}
+	qsort(diffs, POWER_RESAMPLES, sizeof (double), doublecmp);
+	threshold = diffs[(int)(conf / 100 * (POWER_RESAMPLES - 1))];
+	for (i = 0; i < POWER_RESAMPLES; i++) {
+		a = sample_median(runs_us, runs, buf, n, &seed);
+		b = sample_median(runs_us, runs, buf, n, &seed) *
+		    (1 + effect / 100);
+		if ((b - a) / a > threshold)
+			detected++;
+	}
+	return (double)detected / POWER_RESAMPLES;
+}
+
+void print_power(unsigned long long *runs_us, int runs, double conf)
+{
+	const double effects[] = { 0.5, 1, 2, 5 };
+	double *buf, *diffs;
+	char more[16];
+	int e, lo, hi, mid;
+
+	if (runs < 10) {
+		printf("\nPower analysis needs at least 10 runs.\n");
+		return;
+	}
+	if ((buf = malloc(POWER_MAXN * sizeof (double))) == NULL ||
+	    (diffs = malloc(POWER_RESAMPLES * sizeof (double))) == NULL)
+		return;
+
+	printf("\nRepetitions needed to detect a slowdown (median of runs, "
+	    "%g%% confidence,\n%.0f%% power, %d bootstrap resamples of "
+	    "%d runs):\n", conf, POWER_TARGET * 100, POWER_RESAMPLES, runs);
+	printf("%8s %8s\n", "Effect", "Runs");
+	for (e = 0; e < sizeof (effects) / sizeof (effects[0]); e++) {
+		// double to find a sufficient count, then bisect
+		for (hi = 2; hi <= POWER_MAXN && power_at(runs_us, runs,
+		    effects[e], conf, hi, buf, diffs) < POWER_TARGET; hi *= 2)
+			;
+		if (hi > POWER_MAXN) {
+			snprintf(more, sizeof (more), ">%d", POWER_MAXN);
+			printf("%7g%% %8s\n", effects[e], more);
+			continue;
+		}
+		lo = hi / 2;
+		while (hi - lo > 1) {
+			mid = (lo + hi) / 2;
+			if (power_at(runs_us, runs, effects[e], conf, mid, buf,
+			    diffs) < POWER_TARGET)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		printf("%7g%% %8d\n", effects[e], hi);
+	}
+	free(buf);
+	free(diffs);
+}
+
+/*
+ * Memory management counters (-V): deltas of system-wide /proc/vmstat
+ * counters for reclaim, compaction, THP collapse and NUMA balancing, read
+ * between runs, with this process's minor and major faults. The summary
+ * correlates each with run time, and compares the mean time of runs with
+ * and without it.
+ */
+#define VM_COUNTERS	8
+#define VM_VMSTAT	6	// the rest are from getrusage
+
+const char *g_vmnames[VM_COUNTERS] = {
+	"pgscan_kswapd", "pgscan_direct", "compact_stall",
+	"thp_collapse_alloc", "numa_hint_faults", "pgmigrate_success",
+	"minflt", "majflt"
+};
+int g_vmfd = -1;
+
+// reads the /proc/vmstat counters into vals; missing ones read as 0
+void vm_read(unsigned long long *vals)
+{
+	static char buf[32768];
+	char *line, *save, *p;
+	ssize_t len;
+	int i;
+
+	memset(vals, 0, VM_VMSTAT * sizeof (*vals));
+	if ((len = pread(g_vmfd, buf, sizeof (buf) - 1, 0)) <= 0)
+		return;
+	buf[len] = '\0';
+	for (line = strtok_r(buf, "\n", &save); line != NULL;
+	    line = strtok_r(NULL, "\n", &save)) {
+		if ((p = strchr(line, ' ')) == NULL)
+			continue;
+		*p = '\0';
+		for (i = 0; i < VM_VMSTAT; i++) {
+			if (strcmp(line, g_vmnames[i]) == 0) {
+				vals[i] = strtoull(p + 1, NULL, 10);
+				break;
+			}
+		}
+	}
+}
+
+void print_vmstat(unsigned long long *runs_us,
+    unsigned long long (*runs_vm)[VM_COUNTERS], int runs)
+{
+	unsigned long long total, with_us, without_us;
+	double x, y, sx, sy, sxx, syy, sxy, r;
+	int i, j, nwith;
+
+	printf("\nMemory management events (vmstat system wide, faults this "
+	    "process):\n");
+	printf("%-20s %10s %6s %8s %10s %12s\n", "COUNTER", "TOTAL", "RUNS",
+	    "CORR(r)", "WITH(ms)", "WITHOUT(ms)");
+	for (j = 0; j < VM_COUNTERS; j++) {
+		total = with_us = without_us = 0;
+		sx = sy = sxx = syy = sxy = 0;
+		for (i = nwith = 0; i < runs; i++) {
+			x = runs_vm[i][j];
+			y = runs_us[i];
+			total += runs_vm[i][j];
+			if (runs_vm[i][j]) {
+				nwith++;
+				with_us += runs_us[i];
+			} else {
+				without_us += runs_us[i];
+			}
+			sx += x;
+			sy += y;
+			sxx += x * x;
+			syy += y * y;
+			sxy += x * y;
+		}
+		printf("%-20s %10llu %6d ", g_vmnames[j], total, nwith);
+		if ((r = pearson(runs, sx, sy, sxx, syy, sxy)) >= -1)
+			printf("%8.3f ", r);
+		else
+			printf("%8s ", "-");
+		if (nwith)
+			printf("%10.3f ", (double)with_us / nwith / 1000);
+		else
+			printf("%10s ", "-");
+		if (runs - nwith)
+			printf("%12.3f\n", (double)without_us / (runs - nwith) /
+			    1000);
+		else
+			printf("%12s\n", "-");
+	}
+}
+
+/*
+ * Energy (-E): RAPL package and DRAM energy counters from powercap, read
+ * between runs and summed over packages. The counters update about once
+ * a millisecond, so short runs are coarse. The summary correlates power
+ * with run time: slow runs at lower power, near the package limit, point
+ * to power capping.
+ */
+#define RAPL_DIR	"/sys/class/powercap"
+#define RAPL_ZONES	32
+#define RAPL_PKG	0
+#define RAPL_DRAM	1
+#define RAPL_SECS	2	// per run elapsed seconds, for watts
+#define RAPL_ITERS	3	// per run iterations, for energy per iteration
+
+struct raplzone {
+	int kind;	// RAPL_PKG or RAPL_DRAM
+	int fd;		// energy_uj
+	unsigned long long max_uj;
+};
+
+struct raplzone g_rapl[RAPL_ZONES];
+int g_nrapl, g_nrapl_kind[2];
+double g_rapl_limit_w[2];	// package long and short term, summed
+
+int rapl_setup(void)
+{
+	char path[PATH_MAX], name[64];
+	unsigned long long val;
+	struct raplzone *rz;
+	struct dirent *de;
+	DIR *dir;
+	int i;
+
+	if ((dir = opendir(RAPL_DIR)) == NULL) {
+		printf("ERROR: can't open %s: %s (RAPL powercap driver "
+		    "loaded?)\n", RAPL_DIR, strerror(errno));
+		return -1;
+	}
+	// intel-rapl:N are packages, intel-rapl:N:M their subzones
+	while ((de = readdir(dir)) != NULL && g_nrapl < RAPL_ZONES) {
+		if (strncmp(de->d_name, "intel-rapl:", 11) != 0)
+			continue;
+		snprintf(path, sizeof (path), "%s/%s/name", RAPL_DIR,
+		    de->d_name);
+		if (readfile_str(path, name, sizeof (name)) != 0)
+			continue;
+		rz = &g_rapl[g_nrapl];
+		if (strncmp(name, "package", 7) == 0)
+			rz->kind = RAPL_PKG;
+		else if (strcmp(name, "dram") == 0)
+			rz->kind = RAPL_DRAM;
+		else
+			continue;
+		// without the range, a counter wrap can't be accounted for
+		snprintf(path, sizeof (path), "%s/%s/max_energy_range_uj",
+		    RAPL_DIR, de->d_name);
+		if (readfile_ull(path, &rz->max_uj) != 0 || !rz->max_uj) {
+			printf("WARNING: skipping RAPL zone %s: can't read "
+			    "%s\n", de->d_name, path);
+			continue;
+		}
+		snprintf(path, sizeof (path), "%s/%s/energy_uj", RAPL_DIR,
+		    de->d_name);
+		if ((rz->fd = open(path, O_RDONLY)) < 0) {
+			printf("ERROR: can't open %s: %s\n", path,
+			    strerror(errno));
+			closedir(dir);
+			return -1;
+		}
+		for (i = 0; rz->kind == RAPL_PKG && i < 2; i++) {
+			snprintf(path, sizeof (path),
+			    "%s/%s/constraint_%d_power_limit_uw", RAPL_DIR,
+			    de->d_name, i);
+			if (readfile_ull(path, &val) == 0)
+				g_rapl_limit_w[i] += (double)val / 1000000;
+		}
+		g_nrapl_kind[rz->kind]++;
+		g_nrapl++;
+	}
+	closedir(dir);
+	if (!g_nrapl_kind[RAPL_PKG]) {
+		printf("ERROR: no RAPL package zones in %s\n", RAPL_DIR);
+		return -1;
+	}
+	return 0;
+}
+
+void rapl_read(unsigned long long *uj)
+{
+	char buf[32];
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < g_nrapl; i++) {
+		len = pread(g_rapl[i].fd, buf, sizeof (buf) - 1, 0);
+		buf[len > 0 ? len : 0] = '\0';
+		uj[i] = strtoull(buf, NULL, 10);
+	}
+}
+
+// joules used between two reads, by kind, allowing for wraparound
+void rapl_joules(unsigned long long *before, unsigned long long *after,
+    double *joules)
+{
+	unsigned long long uj;
+	int i;
+
+	joules[RAPL_PKG] = joules[RAPL_DRAM] = 0;
+	for (i = 0; i < g_nrapl; i++) {
+		uj = after[i] >= before[i] ? after[i] - before[i] :
+		    after[i] + g_rapl[i].max_uj - before[i];
+		joules[g_rapl[i].kind] += (double)uj / 1000000;
+	}
+}
+
+/*
+ * Energy summary. runs_us must still be in run order. Power of the
+ * slowest 10% of runs is compared with the fastest half.
+ */
+void print_energy(unsigned long long *runs_us, double (*runs_energy)[4],
+    int runs)
+{
+	unsigned long long *sorted, slow_us, fast_us;
+	double joules, secs, iters, w, y, sx, sy, sxx, syy, sxy, r;
+	double slow_w, fast_w;
+	int kind, i, nslow, nfast;
+
+	if ((sorted = malloc(runs * sizeof (*sorted))) == NULL)
+		return;
+	memcpy(sorted, runs_us, runs * sizeof (*sorted));
+	qsort(sorted, runs, sizeof (*sorted), ullcmp);
+	slow_us = sorted[runs * 90 / 100 < runs ? runs * 90 / 100 : runs - 1];
+	fast_us = sorted[(runs - 1) / 2];
+	free(sorted);
+
+	printf("\nEnergy (RAPL, %d package%s", g_nrapl_kind[RAPL_PKG],
+	    g_nrapl_kind[RAPL_PKG] == 1 ? "" : "s");
+	if (g_nrapl_kind[RAPL_DRAM])
+		printf(", %d DRAM", g_nrapl_kind[RAPL_DRAM]);
+	printf("):\n");
+	printf("%-8s %10s %8s %10s %8s %11s %11s\n", "ZONE", "J/RUN",
+	    "WATTS", "nJ/ITER", "CORR(r)", "SLOW10%(W)", "FAST50%(W)");
+	for (kind = RAPL_PKG; kind <= RAPL_DRAM; kind++) {
+		if (!g_nrapl_kind[kind])
+			continue;
+		joules = secs = iters = slow_w = fast_w = 0;
+		sx = sy = sxx = syy = sxy = 0;
+		for (i = nslow = nfast = 0; i < runs; i++) {
+			joules += runs_energy[i][kind];
+			secs += runs_energy[i][RAPL_SECS];
+			iters += runs_energy[i][RAPL_ITERS];
+			w = runs_energy[i][RAPL_SECS] > 0 ? runs_energy[i][kind] /
+			    runs_energy[i][RAPL_SECS] : 0;
+			y = runs_us[i];
+			sx += w;
+			sy += y;
+			sxx += w * w;
+			syy += y * y;
+			sxy += w * y;
+			if (runs_us[i] >= slow_us) {
+				slow_w += w;
+				nslow++;
+			}
+			if (runs_us[i] <= fast_us) {
+				fast_w += w;
+				nfast++;
+			}
+		}
+		printf("%-8s %10.4f %8.2f ", kind == RAPL_PKG ? "package" :
+		    "dram", joules / runs, secs > 0 ? joules / secs : 0);
+		if (iters > 0)
+			printf("%10.3f ", joules * 1e9 / iters);
+		else
+			printf("%10s ", "-");
+		// power against run time
+		if ((r = pearson(runs, sx, sy, sxx, syy, sxy)) >= -1)
+			printf("%8.3f ", r);
+		else
+			printf("%8s ", "-");
+		printf("%11.2f %11.2f\n", slow_w / nslow, fast_w / nfast);
+	}
+	if (g_rapl_limit_w[0] > 0)
+		printf("Package power limits: %.1f W long term, %.1f W short "
+		    "term\n", g_rapl_limit_w[0], g_rapl_limit_w[1]);
+}
+
+/*
+ * Slow run snapshots (-z pct). Before each run, per-thread CPU time is
+ * read from /proc/PID/task/TID/schedstat, with the last CPU used from
+ * stat. When a run is more than pct slower than the fastest so far, this
+ * is read again, and the threads that used CPU and were last on the
+ * benchmark CPU (or any CPU, if not pinned) are kept with the run's
+ * interrupt and softirq deltas and the load average. This costs time
+ * between runs, but not within them.
+ */
+#define SNAP_MAX	100	// slow runs kept
+#define SNAP_TASKS	5	// threads kept per run
+
+struct taskstat {
+	int tid;
+	int cpu;
+	unsigned long long ns;
+	char comm[16];
+};
+
+struct snapshot {
+	int run;
+	double pct;
+	unsigned long long irqs;
+	unsigned long long softirqs;
+	char load[64];
+	int ntasks;
+	struct taskstat tasks[SNAP_TASKS];
+};
+
+struct taskstat *g_snaptasks;
+int g_nsnaptasks, g_snapalloc;
+unsigned long long g_snapirqs, g_snapsoftirqs;
+struct snapshot g_snaps[SNAP_MAX];
+int g_nsnaps, g_slowruns;
+
+static int taskcmp(const void *p1, const void *p2)
+{
+	const struct taskstat *a = p1, *b = p2;
+
+	return a->tid - b->tid;
+}
+
+// reads all threads into tasks, sorted by tid. Returns the count.
+static int snap_tasks(struct taskstat **tasks, int *alloc)
+{
+	char path[128], line[1024], *p;
+	struct dirent *de, *tde;
+	DIR *dir, *tdir;
+	FILE *fp;
+	int n = 0, pid, tid, field;
+	struct taskstat *t;
+
+	if ((dir = opendir("/proc")) == NULL)
+		return 0;
+	while ((de = readdir(dir)) != NULL) {
+		if ((pid = atoi(de->d_name)) <= 0)
+			continue;
+		snprintf(path, sizeof (path), "/proc/%d/task", pid);
+		if ((tdir = opendir(path)) == NULL)
+			continue;
+		while ((tde = readdir(tdir)) != NULL) {
+			if ((tid = atoi(tde->d_name)) <= 0)
+				continue;
+			if (n == *alloc) {
+				*alloc = *alloc ? *alloc * 2 : 1024;
+				if ((*tasks = realloc(*tasks, *alloc *
+				    sizeof (struct taskstat))) == NULL) {
+					printf("ERROR: can't allocate task "
+					    "stats\n");
+					exit(1);
+				}
+			}
+			t = &(*tasks)[n];
+			snprintf(path, sizeof (path),
+			    "/proc/%d/task/%d/schedstat", pid, tid);
+			if ((fp = fopen(path, "r")) == NULL)
+				continue;
+			if (fscanf(fp, "%llu", &t->ns) != 1) {
+				fclose(fp);
+				continue;
+			}
+			fclose(fp);
+			snprintf(path, sizeof (path), "/proc/%d/task/%d/stat",
+			    pid, tid);
+			if (readfile_str(path, line, sizeof (line)) != 0 ||
+			    (p = strrchr(line, ')')) == NULL)
+				continue;
+			*p = '\0';
+			snprintf(t->comm, sizeof (t->comm), "%s",
+			    strchr(line, '(') + 1);
+			// fields from state (3): processor is 39
+			t->cpu = -1;
+			for (field = 3, p = strtok(p + 2, " "); p != NULL;
+			    field++, p = strtok(NULL, " ")) {
+				if (field == 39) {
+					t->cpu = atoi(p);
+					break;
+				}
+			}
+			t->tid = tid;
+			n++;
+		}
+		closedir(tdir);
+	}
+	closedir(dir);
+	qsort(*tasks, n, sizeof (struct taskstat), taskcmp);
+	return n;
+}
+
+// interrupts and softirqs on a CPU, or all CPUs if cpu is -1
+static void snap_irqs(int cpu, unsigned long long *irqs,
+    unsigned long long *softirqs)
+{
+	char line[256];
+	unsigned long long row;
+	FILE *fp;
+
+	if (cpu >= 0) {
+		proc_cpu_table("/proc/interrupts", cpu, "", &row, irqs);
+		proc_cpu_table("/proc/softirqs", cpu, "", &row, softirqs);
+		return;
+	}
+	*irqs = *softirqs = 0;
+	if ((fp = fopen("/proc/stat", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		sscanf(line, "intr %llu", irqs);
+		sscanf(line, "softirq %llu", softirqs);
+	}
+	fclose(fp);
+}
+
+void snap_before(int cpu)
+{
+	g_nsnaptasks = snap_tasks(&g_snaptasks, &g_snapalloc);
+	snap_irqs(cpu, &g_snapirqs, &g_snapsoftirqs);
+}
+
+void snap_after(int run, double pct, int cpu)
+{
+	static struct taskstat *now;
+	static int alloc;
+	struct taskstat *prev;
+	struct snapshot *snap;
+	unsigned long long ns;
+	int n, i, j, self;
+
+	g_slowruns++;
+	if (g_nsnaps == SNAP_MAX)
+		return;
+	snap = &g_snaps[g_nsnaps++];
+	memset(snap, 0, sizeof (*snap));
+	snap->run = run;
+	snap->pct = pct;
+	snap_irqs(cpu, &snap->irqs, &snap->softirqs);
+	snap->irqs -= g_snapirqs;
+	snap->softirqs -= g_snapsoftirqs;
+	readfile_str("/proc/loadavg", snap->load, sizeof (snap->load));
+
+	// the busiest threads, other than this one
+	self = getpid();	// the benchmark (main) thread
+	n = snap_tasks(&now, &alloc);
+	for (i = 0; i < n; i++) {
+		if (now[i].tid == self || (cpu >= 0 && now[i].cpu != cpu))
+			continue;
+		prev = bsearch(&now[i], g_snaptasks, g_nsnaptasks,
+		    sizeof (struct taskstat), taskcmp);
+		// new threads count from zero
+		ns = now[i].ns - (prev ? prev->ns : 0);
+		if (!ns)
+			continue;
+		for (j = snap->ntasks; j > 0 && snap->tasks[j - 1].ns < ns;
+		    j--) {
+			if (j < SNAP_TASKS)
+				snap->tasks[j] = snap->tasks[j - 1];
+		}
+		if (j < SNAP_TASKS) {
+			snap->tasks[j] = now[i];
+			snap->tasks[j].ns = ns;
+			if (snap->ntasks < SNAP_TASKS)
+				snap->ntasks++;
+		}
+	}
+}
+
+void print_snapshots(double threshold, int cpu)
+{
+	struct snapshot *snap;
+	int i, j;
+
+	printf("\n%d runs were over %g%% slower than the fastest so far",
+	    g_slowruns, threshold);
+	if (g_slowruns > g_nsnaps)
+		printf(" (first %d shown)", g_nsnaps);
+	printf("%s\n", g_nsnaps ? ":" : ".");
+	for (i = 0; i < g_nsnaps; i++) {
+		snap = &g_snaps[i];
+		printf("Run %d: %.3f%% slower, %s %llu, softirqs %llu, "
+		    "load %s\n", snap->run + 1, snap->pct,
+		    cpu >= 0 ? "CPU IRQs" : "IRQs", snap->irqs,
+		    snap->softirqs, snap->load);
+		for (j = 0; j < snap->ntasks; j++) {
+			printf("    %10.3f ms  %s (%d)", (double)
+			    snap->tasks[j].ns / 1000000, snap->tasks[j].comm,
+			    snap->tasks[j].tid);
+			if (cpu < 0)
+				printf(" on CPU %d", snap->tasks[j].cpu);
+			printf("\n");
+		}
+	}
+}
+
+#ifdef __linux__
+/*
+ * Kernel tracing (-K): creates a per-process tracefs instance,
+ * p1bench_<pid>, so concurrent runs don't share one, and enables the events
+ * in it. Tracing is limited to the benchmark CPU, and each run is bracketed
+ * with trace_marker writes. The trace is drained to a temporary file
+ * between runs, outside the timed window. Afterwards, the slowest runs are
+ * reported with the tasks that ran while p1bench was switched out (from
+ * sched_switch), and counts of the other events that fired during them. The
+ * instance is removed on exit.
+ */
+#define TRACE_SLOW	10	// slowest runs reported
+#define TRACE_TOP	5	// events shown per run
+#define TRACE_KEYS	64	// distinct events kept per run
+
+const char *g_trace_default = "sched:sched_switch,irq:irq_handler_entry,"
+    "irq:softirq_entry,workqueue:workqueue_execute_start";
+char g_tracedir[PATH_MAX];
+int g_tracemark = -1, g_tracepipe = -1;
+FILE *g_tracefp;
+
+struct tracekey {
+	char key[64];
+	unsigned long long ns;		// time switched out to this task
+	unsigned long long count;
+};
+
+static int trace_write(const char *file, const char *val)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof (path), "%s/%s", g_tracedir, file) >=
+	    (int)sizeof (path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return writefile(path, val);
+}
+
+void trace_cleanup(void)
+{
+	if (!g_tracedir[0])
+		return;
+	(void) trace_write("tracing_on", "0");
+	if (g_tracemark >= 0)
+		close(g_tracemark);
+	if (g_tracepipe >= 0)
+		close(g_tracepipe);
+	// removing the instance disables its events and frees its buffers
+	rmdir(g_tracedir);
+}
+
+int trace_setup(char *events, int cpu)
+{
+	char path[PATH_MAX + 64], mask[256], *ev, *p, *save;
+	int i;
+
+	if (access("/sys/kernel/tracing/instances", F_OK) == 0)
+		snprintf(g_tracedir, sizeof (g_tracedir),
+		    "/sys/kernel/tracing/instances/p1bench_%d", getpid());
+	else
+		snprintf(g_tracedir, sizeof (g_tracedir),
+		    "/sys/kernel/debug/tracing/instances/p1bench_%d",
+		    getpid());
+	if (mkdir(g_tracedir, 0755) != 0) {
+		printf("ERROR: can't create %s: %s (is tracefs mounted?)\n",
+		    g_tracedir, strerror(errno));
+		g_tracedir[0] = '\0';
+		return -1;
+	}
+	atexit(trace_cleanup);
+
+	// CPU mask, as comma separated 32-bit words, most significant first
+	snprintf(mask, sizeof (mask), "%x", 1U << (cpu % 32));
+	for (i = 0; i < cpu / 32 && strlen(mask) < sizeof (mask) - 10; i++)
+		strcat(mask, ",00000000");
+	if (trace_write("tracing_on", "0") != 0 ||
+	    trace_write("tracing_cpumask", mask) != 0 ||
+	    trace_write("buffer_size_kb", "4096") != 0 ||
+	    trace_write("options/irq-info", "0") != 0) {
+		printf("ERROR: can't configure %s: %s\n", g_tracedir,
+		    strerror(errno));
+		return -1;
+	}
+
+	if (strcmp(events, "default") == 0)
+		events = strdup(g_trace_default);
+	for (ev = strtok_r(events, ",", &save); ev != NULL;
+	    ev = strtok_r(NULL, ",", &save)) {
+		if ((p = strchr(ev, ':')) == NULL) {
+			printf("ERROR: -K events must be subsystem:event\n");
+			return -1;
+		}
+		*p = '/';
+		snprintf(path, sizeof (path), "events/%s/enable", ev);
+		if (trace_write(path, "1") != 0) {
+			printf("ERROR: can't enable %s: %s\n", ev,
+			    strerror(errno));
+			return -1;
+		}
+	}
+
+	snprintf(path, sizeof (path), "%s/trace_marker", g_tracedir);
+	if ((g_tracemark = open(path, O_WRONLY)) < 0)
+		goto err;
+	snprintf(path, sizeof (path), "%s/trace_pipe", g_tracedir);
+	if ((g_tracepipe = open(path, O_RDONLY | O_NONBLOCK)) < 0)
+		goto err;
+	if ((g_tracefp = tmpfile()) == NULL)
+		goto err;
+	return trace_write("tracing_on", "1");
+
+err:
+	printf("ERROR: can't open %s: %s\n", path, strerror(errno));
+	return -1;
+}
+
+void trace_mark(int run, const char *what)
+{
+	char buf[64];
+	int len;
+
+	len = snprintf(buf, sizeof (buf), "p1bench run %d %s\n", run, what);
+	(void) write(g_tracemark, buf, len);
+}
+
+// copies what the trace buffer has so far to the temporary file
+void trace_drain(void)
+{
+	char buf[65536];
+	ssize_t len;
+
+	while ((len = read(g_tracepipe, buf, sizeof (buf))) > 0)
+		fwrite(buf, 1, len, g_tracefp);
+}
+
+static void trace_add(struct tracekey *keys, int *nkeys, const char *key,
+    unsigned long long ns)
+{
+	int i;
+
+	for (i = 0; i < *nkeys; i++) {
+		if (strcmp(keys[i].key, key) == 0)
+			break;
+	}
+	if (i == *nkeys) {
+		if (*nkeys == TRACE_KEYS)
+			return;
+		snprintf(keys[i].key, sizeof (keys[i].key), "%s", key);
+		keys[i].ns = keys[i].count = 0;
+		(*nkeys)++;
+	}
+	keys[i].ns += ns;
+	keys[i].count++;
+}
+
+static int tracekeycmp(const void *p1, const void *p2)
+{
+	const struct tracekey *a = p1, *b = p2;
+
+	if (a->ns != b->ns)
+		return a->ns < b->ns ? 1 : -1;
+	return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+// copies the text after name= up to end (or a space) into buf
+static void trace_field(const char *line, const char *name,
+    const char *end, char *buf, int len)
+{
+	const char *p, *q;
+
+	buf[0] = '\0';
+	if ((p = strstr(line, name)) == NULL)
+		return;
+	p += strlen(name);
+	if (end == NULL || (q = strstr(p, end)) == NULL)
+		q = p + strcspn(p, " \n");
+	snprintf(buf, len, "%.*s", (int)(q - p), p);
+}
+
+/*
+ * Reports the slowest runs. runs_us must still be in run order. Time
+ * switched out is attributed to each task that ran until p1bench was
+ * switched back in.
+ */
+void trace_report(unsigned long long *runs_us, int runs,
+    unsigned long long fastest_us)
+{
+	struct tracekey (*keys)[TRACE_KEYS];
+	int slow[TRACE_SLOW], nkeys[TRACE_SLOW];
+	int nslow = 0, i, j, run = -1, idx = -1, tid, off = 0;
+	unsigned long long sec, usec, ts, last_ts = 0;
+	char line[4096], event[64], key[128], comm[64], buf[32], *p;
+
+	trace_drain();
+	(void) trace_write("tracing_on", "0");
+
+	// slowest runs, slowest first
+	for (i = 0; i < runs; i++) {
+		for (j = nslow; j > 0 && runs_us[slow[j - 1]] < runs_us[i];
+		    j--) {
+			if (j < TRACE_SLOW)
+				slow[j] = slow[j - 1];
+		}
+		if (j < TRACE_SLOW) {
+			slow[j] = i;
+			if (nslow < TRACE_SLOW)
+				nslow++;
+		}
+	}
+	if ((keys = calloc(TRACE_SLOW, sizeof (*keys))) == NULL)
+		return;
+	memset(nkeys, 0, sizeof (nkeys));
+
+	tid = syscall(SYS_gettid);
+	rewind(g_tracefp);
+	while (fgets(line, sizeof (line), g_tracefp) != NULL) {
+		// "comm-pid [cpu] [flags] secs.usecs: event: fields"
+		if ((p = strstr(line, "] ")) == NULL)
+			continue;
+		p += 2;
+		if (*p < '0' || *p > '9')
+			p += strcspn(p, " ") + 1;
+		if (sscanf(p, "%llu.%llu: %63[^:]:", &sec, &usec, event) != 3)
+			continue;
+		ts = sec * 1000000000ULL + usec * 1000;
+		if (strcmp(event, "tracing_mark_write") == 0) {
+			if (sscanf(strstr(p, "p1bench run ") ? strstr(p,
+			    "p1bench run ") : "", "p1bench run %d %31s", &j,
+			    buf) != 2)
+				continue;
+			run = strcmp(buf, "start") == 0 ? j : -1;
+			for (idx = -1, j = 0; run >= 0 && j < nslow; j++) {
+				if (slow[j] == run)
+					idx = j;
+			}
+			continue;
+		}
+		if (strcmp(event, "sched_switch") == 0) {
+			// time out goes to the task switched away from
+			trace_field(p, "prev_comm=", " prev_pid=", comm,
+			    sizeof (comm));
+			if (off && idx >= 0) {
+				snprintf(key, sizeof (key), "task %s", comm);
+				trace_add(keys[idx], &nkeys[idx], key,
+				    ts - last_ts);
+			}
+			trace_field(p, "next_pid=", NULL, buf, sizeof (buf));
+			if (atoi(buf) == tid) {
+				off = 0;
+			} else {
+				trace_field(p, "prev_pid=", NULL, buf,
+				    sizeof (buf));
+				if (atoi(buf) == tid)
+					off = 1;
+			}
+			last_ts = ts;
+			continue;
+		}
+		if (idx < 0)
+			continue;
+		if (strcmp(event, "irq_handler_entry") == 0) {
+			trace_field(p, "name=", NULL, comm, sizeof (comm));
+			snprintf(key, sizeof (key), "irq %s", comm);
+		} else if (strcmp(event, "softirq_entry") == 0) {
+			trace_field(p, "action=", "]", comm, sizeof (comm));
+			snprintf(key, sizeof (key), "softirq %s", comm);
+		} else if (strcmp(event, "workqueue_execute_start") == 0) {
+			trace_field(p, "function ", NULL, comm, sizeof (comm));
+			snprintf(key, sizeof (key), "workqueue %s", comm);
+		} else {
+			snprintf(key, sizeof (key), "%s", event);
+		}
+		trace_add(keys[idx], &nkeys[idx], key, 0);
+	}
+
+	printf("\nSlowest %d runs, with traced events on the benchmark "
+	    "CPU:\n", nslow);
+	for (i = 0; i < nslow; i++) {
+		printf("Run %d: %.3f ms, %.3f%% slower than fastest\n",
+		    slow[i] + 1, (double)runs_us[slow[i]] / 1000,
+		    (double)100 * (runs_us[slow[i]] - fastest_us) /
+		    fastest_us);
+		if (!nkeys[i]) {
+			printf("    no events traced\n");
+			continue;
+		}
+		qsort(keys[i], nkeys[i], sizeof (struct tracekey),
+		    tracekeycmp);
+		printf("    %10s %7s  %s\n", "OFFCPU(us)", "COUNT", "EVENT");
+		for (j = 0; j < nkeys[i] && j < TRACE_TOP; j++) {
+			if (keys[i][j].ns)
+				printf("    %10.1f", (double)keys[i][j].ns / 1000);
+			else
+				printf("    %10s", "-");
+			printf(" %7llu  %s\n", keys[i][j].count,
+			    keys[i][j].key);
+		}
+	}
+	free(keys);
+}
+#endif	/* __linux__ */
+
+#ifdef __linux__
+/*
+ * Stack profiling (-L prefix): samples the benchmark thread with
+ * perf_event_open at PROF_HZ of CPU time, recording user and kernel
+ * callchains. Inherited per-task events can't be mmap()ed, so -P threads
+ * aren't covered. Sampling is enabled only inside each run, so the ring
+ * buffer drained after the run holds that run's samples. Afterwards,
+ * stacks from the slowest runs (at or above the 90th percentile) and the
+ * fastest half are symbolized, kernel frames from /proc/kallsyms and user
+ * frames from the ELF symbol tables of mapped files, and written in folded
+ * format to prefix.slow.folded and prefix.fast.folded. User stacks are
+ * walked with frame pointers, so code built without them is truncated.
+ * Sampling adds overhead to runs.
+ */
+#define PROF_HZ		997
+#define PROF_PAGES	256	// ring buffer data pages, a power of 2
+#define PROF_HASH	4096
+#define PROF_LINE	16384	// longest folded stack
+
+struct profstack {
+	int next;			// hash chain
+	int nips;
+	unsigned long long *ips;	// as sampled: leaf first
+	unsigned long long count;
+};
+
+struct profsample {
+	int run;
+	int stack;
+};
+
+struct profsym {
+	unsigned long long addr;
+	unsigned long long size;
+	const char *name;
+};
+
+struct profmap {
+	unsigned long long start, end, off, bias;
+	char path[PATH_MAX];
+	struct profsym *syms;
+	int nsyms;
+	int loaded;
+};
+
+int g_proffd = -1, g_profkernel;
+struct perf_event_mmap_page *g_profbuf;
+struct profstack *g_profstacks;
+int g_nprofstacks, g_profstackalloc, g_profhash[PROF_HASH];
+struct profsample *g_profsamples;
+int g_nprofsamples, g_profsamplealloc;
+unsigned long long g_proflost;
+struct profsym *g_ksyms;
+int g_nksyms;
+struct profmap *g_profmaps;
+int g_nprofmaps;
+
+int prof_setup(void)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	memset(&attr, 0, sizeof (attr));
+	attr.size = sizeof (attr);
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.freq = 1;
+	attr.sample_freq = PROF_HZ;
+	attr.sample_type = PERF_SAMPLE_CALLCHAIN;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+	g_proffd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (g_proffd < 0 && (errno == EACCES || errno == EPERM)) {
+		// perf_event_paranoid > 1 allows user stacks only
+		attr.exclude_kernel = 1;
+		g_proffd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (g_proffd < 0) {
+		printf("ERROR: can't open a sampling perf event: %s\n",
+		    strerror(errno));
+		return -1;
+	}
+	g_profkernel = !attr.exclude_kernel;
+	g_profbuf = mmap(NULL, (PROF_PAGES + 1) * getpagesize(),
+	    PROT_READ | PROT_WRITE, MAP_SHARED, g_proffd, 0);
+	if (g_profbuf == MAP_FAILED) {
+		printf("ERROR: can't map the perf ring buffer: %s\n",
+		    strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < PROF_HASH; i++)
+		g_profhash[i] = -1;
+	return 0;
+}
+
+void prof_start(void)
+{
+	(void) ioctl(g_proffd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void prof_stop(void)
+{
+	(void) ioctl(g_proffd, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+static void prof_add(int run, unsigned long long *ips, int nips)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	struct profstack *ps;
+	int i, h;
+
+	for (i = 0; i < nips; i++)
+		hash = (hash ^ ips[i]) * 1099511628211ULL;
+	h = hash % PROF_HASH;
+	for (i = g_profhash[h]; i >= 0; i = g_profstacks[i].next) {
+		if (g_profstacks[i].nips == nips && memcmp(g_profstacks[i].ips,
+		    ips, nips * sizeof (*ips)) == 0)
+			break;
+	}
+	if (i < 0) {
+		if (g_nprofstacks == g_profstackalloc) {
+			g_profstackalloc = g_profstackalloc ?
+			    g_profstackalloc * 2 : 1024;
+			if ((g_profstacks = realloc(g_profstacks,
+			    g_profstackalloc * sizeof (*ps))) == NULL) {
+				printf("ERROR: can't allocate stacks\n");
+				exit(1);
+			}
+		}
+		i = g_nprofstacks++;
+		ps = &g_profstacks[i];
+		if ((ps->ips = malloc(nips * sizeof (*ips))) == NULL) {
+			printf("ERROR: can't allocate stacks\n");
+			exit(1);
+		}
+		memcpy(ps->ips, ips, nips * sizeof (*ips));
+		ps->nips = nips;
+		ps->next = g_profhash[h];
+		g_profhash[h] = i;
+	}
+	if (g_nprofsamples == g_profsamplealloc) {
+		g_profsamplealloc = g_profsamplealloc ?
+		    g_profsamplealloc * 2 : 4096;
+		if ((g_profsamples = realloc(g_profsamples,
+		    g_profsamplealloc * sizeof (struct profsample))) == NULL) {
+			printf("ERROR: can't allocate samples\n");
+			exit(1);
+		}
+	}
+	g_profsamples[g_nprofsamples].run = run;
+	g_profsamples[g_nprofsamples++].stack = i;
+}
+
+// reads the ring buffer, tagging its samples with run
+void prof_drain(int run)
+{
+	static unsigned long long rec[8192];
+	struct perf_event_header *hdr;
+	unsigned long long head, tail, size, off, len;
+	char *data;
+
+	size = (unsigned long long)PROF_PAGES * getpagesize();
+	data = (char *)g_profbuf + getpagesize();
+	head = g_profbuf->data_head;
+	__sync_synchronize();
+	for (tail = g_profbuf->data_tail; tail < head; tail += len) {
+		hdr = (struct perf_event_header *)(data + tail % size);
+		if ((len = hdr->size) == 0)
+			break;
+		// records can wrap around the end of the buffer
+		off = tail % size;
+		if (len > sizeof (rec))
+			continue;
+		if (off + len <= size) {
+			memcpy(rec, data + off, len);
+		} else {
+			memcpy(rec, data + off, size - off);
+			memcpy((char *)rec + size - off, data, len - (size - off));
+		}
+		hdr = (struct perf_event_header *)rec;
+		if (hdr->type == PERF_RECORD_SAMPLE && rec[1] > 0 &&
+		    (rec[1] + 2) * sizeof (*rec) <= len)
+			prof_add(run, &rec[2], rec[1]);
+		else if (hdr->type == PERF_RECORD_LOST)
+			g_proflost += rec[2];
+	}
+	__sync_synchronize();
+	g_profbuf->data_tail = tail;
+}
+
+static int profsymcmp(const void *p1, const void *p2)
+{
+	const struct profsym *a = p1, *b = p2;
+
+	return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+static const char *prof_lookup(struct profsym *syms, int nsyms,
+    unsigned long long addr)
+{
+	int lo = 0, hi = nsyms - 1, mid;
+
+	// the last symbol at or below addr
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (syms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	if (hi < 0 || (syms[hi].size && addr >= syms[hi].addr + syms[hi].size))
+		return NULL;
+	return syms[hi].name;
+}
+
+static void prof_kallsyms(void)
+{
+	char line[512], name[256], type;
+	unsigned long long addr;
+	int alloc = 0;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/kallsyms", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (sscanf(line, "%llx %c %255s", &addr, &type, name) != 3 ||
+		    (type != 't' && type != 'T') || addr == 0)
+			continue;
+		if (g_nksyms == alloc) {
+			alloc = alloc ? alloc * 2 : 65536;
+			if ((g_ksyms = realloc(g_ksyms,
+			    alloc * sizeof (struct profsym))) == NULL) {
+				g_nksyms = 0;
+				break;
+			}
+		}
+		g_ksyms[g_nksyms].addr = addr;
+		g_ksyms[g_nksyms].size = 0;
+		g_ksyms[g_nksyms++].name = strdup(name);
+	}
+	fclose(fp);
+	qsort(g_ksyms, g_nksyms, sizeof (struct profsym), profsymcmp);
+}
+
+// executable mappings of this process
+static void prof_maps(void)
+{
+	char line[PATH_MAX + 128], perms[8];
+	struct profmap *m;
+	int alloc = 0;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/maps", "r")) == NULL)
+		return;
+	while (fgets(line, sizeof (line), fp) != NULL) {
+		if (g_nprofmaps == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			if ((g_profmaps = realloc(g_profmaps,
+			    alloc * sizeof (struct profmap))) == NULL) {
+				g_nprofmaps = 0;
+				break;
+			}
+		}
+		m = &g_profmaps[g_nprofmaps];
+		memset(m, 0, sizeof (*m));
+		if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %4095[^\n]",
+		    &m->start, &m->end, perms, &m->off, m->path) < 4 ||
+		    strchr(perms, 'x') == NULL)
+			continue;
+		g_nprofmaps++;
+	}
+	fclose(fp);
+}
+
+/*
+ * Loads function symbols for a mapping from its file: .symtab, or
+ * .dynsym if stripped. The file stays mapped for the symbol names.
+ */
+static void prof_elf(struct profmap *m)
+{
+	ElfW(Ehdr) *eh;
+	ElfW(Phdr) *ph;
+	ElfW(Shdr) *sh, *symsh = NULL;
+	ElfW(Sym) *sym;
+	struct stat st;
+	char *base, *strtab;
+	int fd, i, n;
+
+	m->loaded = 1;
+	if (m->path[0] != '/' || (fd = open(m->path, O_RDONLY)) < 0)
+		return;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof (*eh) ||
+	    (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+	    MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	close(fd);
+	eh = (ElfW(Ehdr) *)base;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != (sizeof (void *) == 8 ? ELFCLASS64 :
+	    ELFCLASS32) ||
+	    eh->e_phoff + eh->e_phnum * sizeof (*ph) > (size_t)st.st_size ||
+	    eh->e_shoff + eh->e_shnum * sizeof (*sh) > (size_t)st.st_size)
+		goto out;
+
+	// addresses in the mapping to link time addresses, via its segment
+	ph = (ElfW(Phdr) *)(base + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type == PT_LOAD && m->off >= ph[i].p_offset &&
+		    m->off < ph[i].p_offset + ph[i].p_filesz)
+			break;
+	}
+	if (i == eh->e_phnum)
+		goto out;
+	m->bias = ph[i].p_vaddr - ph[i].p_offset + m->off - m->start;
+
+	sh = (ElfW(Shdr) *)(base + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type == SHT_SYMTAB ||
+		    (sh[i].sh_type == SHT_DYNSYM && symsh == NULL))
+			symsh = &sh[i];
+	}
+	if (symsh == NULL || symsh->sh_link >= eh->e_shnum ||
+	    symsh->sh_offset + symsh->sh_size > (size_t)st.st_size ||
+	    sh[symsh->sh_link].sh_offset + sh[symsh->sh_link].sh_size >
+	    (size_t)st.st_size)
+		goto out;
+	sym = (ElfW(Sym) *)(base + symsh->sh_offset);
+	strtab = base + sh[symsh->sh_link].sh_offset;
+	n = symsh->sh_size / sizeof (*sym);
+	if ((m->syms = malloc(n * sizeof (struct profsym))) == NULL)
+		goto out;
+	for (i = 0; i < n; i++) {
+		if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC ||
+		    sym[i].st_shndx == SHN_UNDEF || !sym[i].st_value ||
+		    sym[i].st_name >= sh[symsh->sh_link].sh_size)
+			continue;
+		m->syms[m->nsyms].addr = sym[i].st_value;
+		m->syms[m->nsyms].size = sym[i].st_size;
+		m->syms[m->nsyms++].name = strtab + sym[i].st_name;
+	}
+	qsort(m->syms, m->nsyms, sizeof (struct profsym), profsymcmp);
+	return;
+
+out:
+	munmap(base, st.st_size);
+}
+
+// appends a frame to a folded stack: name;
+static void prof_frame(char *line, int *len, unsigned long long ip,
+    int kernel)
+{
+	const char *name = NULL, *p;
+	struct profmap *m = NULL;
+	char buf[PATH_MAX + 2];
+	int i;
+
+	if (kernel) {
+		name = prof_lookup(g_ksyms, g_nksyms, ip);
+		*len += snprintf(line + *len, PROF_LINE - *len, "%s_[k];",
+		    name ? name : "[kernel]");
+		if (*len >= PROF_LINE)
+			*len = PROF_LINE - 1;
+		return;
+	}
+	for (i = 0; i < g_nprofmaps; i++) {
+		if (ip >= g_profmaps[i].start && ip < g_profmaps[i].end) {
+			m = &g_profmaps[i];
+			if (!m->loaded)
+				prof_elf(m);
+			name = prof_lookup(m->syms, m->nsyms, ip + m->bias);
+			break;
+		}
+	}
+	// without a symbol, the file name
+	if (name == NULL && m != NULL && m->path[0]) {
+		p = strrchr(m->path, '/');
+		snprintf(buf, sizeof (buf), "[%s]", p ? p + 1 : m->path);
+		name = buf;
+	}
+	*len += snprintf(line + *len, PROF_LINE - *len, "%s;",
+	    name ? name : "[unknown]");
+	if (*len >= PROF_LINE)
+		*len = PROF_LINE - 1;
+}
+
+static int strpcmp(const void *p1, const void *p2)
+{
+	return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+/*
+ * Writes the stacks counted in g_profstacks to a folded file, root first.
+ * Stacks that only differ by address within functions are merged.
+ * Returns the samples written, or -1 on error.
+ */
+static long long prof_write(const char *path)
+{
+	char line[PROF_LINE], **lines;
+	struct profstack *ps;
+	unsigned long long ip, total = 0;
+	int i, j, k, n = 0, len, kernel;
+	FILE *fp;
+
+	if ((lines = malloc((g_nprofstacks + 1) * sizeof (char *))) == NULL ||
+	    (fp = fopen(path, "w")) == NULL)
+		return -1;
+	for (i = 0; i < g_nprofstacks; i++) {
+		ps = &g_profstacks[i];
+		if (!ps->count)
+			continue;
+		len = snprintf(line, sizeof (line), "p1bench;");
+		// walk from the root: the end of the chain
+		for (j = ps->nips - 1; j >= 0; j--) {
+			if (ps->ips[j] >= (unsigned long long)PERF_CONTEXT_MAX)
+				continue;
+			// the context marker comes before its frames
+			kernel = 0;
+			for (k = j - 1; k >= 0; k--) {
+				ip = ps->ips[k];
+				if (ip >= (unsigned long long)PERF_CONTEXT_MAX) {
+					kernel = ip == (unsigned long long)
+					    PERF_CONTEXT_KERNEL;
+					break;
+				}
+			}
+			prof_frame(line, &len, ps->ips[j], kernel);
+		}
+		snprintf(line + len - 1, sizeof (line) - len + 1, " %llu",
+		    ps->count);
+		total += ps->count;
+		if ((lines[n++] = strdup(line)) == NULL)
+			return -1;
+	}
+	// sorted, so equal stacks are adjacent
+	qsort(lines, n, sizeof (char *), strpcmp);
+	for (i = 0; i < n; i = j) {
+		len = strrchr(lines[i], ' ') - lines[i];
+		ip = strtoull(lines[i] + len + 1, NULL, 10);
+		for (j = i + 1; j < n && strncmp(lines[i], lines[j], len + 1) ==
+		    0 && strchr(lines[j] + len + 1, ';') == NULL; j++)
+			ip += strtoull(lines[j] + len + 1, NULL, 10);
+		fprintf(fp, "%.*s %llu\n", len, lines[i], ip);
+	}
+	for (i = 0; i < n; i++)
+		free(lines[i]);
+	free(lines);
+	if (fclose(fp) != 0)
+		return -1;
+	return total;
+}
+
+/*
+ * Writes the slow and fast run stacks. runs_us must still be in run
+ * order.
+ */
+void prof_report(const char *prefix, unsigned long long *runs_us, int runs)
+{
+	unsigned long long *sorted, limit[2];
+	char path[PATH_MAX];
+	long long samples;
+	int slow, i, nruns;
+
+	prof_stop();
+	if ((sorted = malloc(runs * sizeof (*sorted))) == NULL)
+		return;
+	memcpy(sorted, runs_us, runs * sizeof (*sorted));
+	qsort(sorted, runs, sizeof (*sorted), ullcmp);
+	limit[1] = sorted[runs * 90 / 100 < runs ? runs * 90 / 100 : runs - 1];
+	limit[0] = sorted[(runs - 1) / 2];
+	free(sorted);
+	prof_kallsyms();
+	prof_maps();
+
+	printf("\nProfile: %d samples at %d Hz, %s stacks", g_nprofsamples,
+	    PROF_HZ, g_profkernel ? "user and kernel" : "user");
+	if (g_profkernel && !g_nksyms)
+		printf(" (kernel symbols unavailable)");
+	if (g_proflost)
+		printf(", %llu lost", g_proflost);
+	printf("\n");
+	for (slow = 1; slow >= 0; slow--) {
+		for (i = 0; i < g_nprofstacks; i++)
+			g_profstacks[i].count = 0;
+		for (i = 0; i < g_nprofsamples; i++) {
+			if (slow ? runs_us[g_profsamples[i].run] >= limit[1] :
+			    runs_us[g_profsamples[i].run] <= limit[0])
+				g_profstacks[g_profsamples[i].stack].count++;
+		}
+		for (i = nruns = 0; i < runs; i++) {
+			if (slow ? runs_us[i] >= limit[1] :
+			    runs_us[i] <= limit[0])
+				nruns++;
+		}
+		snprintf(path, sizeof (path), "%s.%s.folded", prefix,
+		    slow ? "slow" : "fast");
+		if ((samples = prof_write(path)) < 0) {
+			printf("ERROR: writing %s: %s\n", path,
+			    strerror(errno));
+			return;
+		}
+		printf("%s %d runs (%s %.3f ms): %lld samples to %s\n",
+		    slow ? "Slowest" : "Fastest", nruns, slow ? ">=" : "<=",
+		    (double)limit[slow] / 1000, samples, path);
+	}
+	printf("Compare: difffolded.pl -n %s.fast.folded %s.slow.folded | "
+	    "flamegraph.pl\n", prefix, prefix);
+}
+#endif	/* __linux__ */
+
+/*
+ * Heatmaps of perturbation over time (-H, -g). Columns are equal slices of
+ * the test duration, rows are the histogram buckets, and each cell's color
+ * is the number of runs that started in that slice and landed in that
+ * bucket. This shows time structure the histogram collapses, such as a
+ * daemon waking up every N seconds.
+ */
+#define HEAT_COLS	72	// terminal columns
+
+int *heatmap_build(unsigned long long *start_us, double *pcts, int runs,
+    int cols, int *rows, int *max_count, unsigned long long *span_us)
+{
+	int *cells;
+	int i, col, idx;
+
+	*rows = 0;
+	*max_count = 0;
+	*span_us = start_us[runs - 1] + 1;
+	if ((cells = calloc(cols * BUCKETS, sizeof (int))) == NULL)
+		return NULL;
+	for (i = 0; i < runs; i++) {
+		col = start_us[i] * cols / *span_us;
+		idx = hist_idx(pcts[i], BUCKETS);
+		if (++cells[idx * cols + col] > *max_count)
+			*max_count = cells[idx * cols + col];
+		if (idx + 1 > *rows)
+			*rows = idx + 1;
+	}
+	return cells;
+}
+
+void print_heatmap(unsigned long long *start_us, double *pcts, int runs)
+{
+	// ANSI 256 color ramp, light yellow to dark red
+	static const int ramp[] = { 230, 229, 221, 214, 208, 202, 196, 160 };
+	int nramp = sizeof (ramp) / sizeof (ramp[0]);
+	unsigned long long span_us;
+	int *cells, cols, rows, max_count, row, col, n;
+
+	cols = runs < HEAT_COLS ? runs : HEAT_COLS;
+	if ((cells = heatmap_build(start_us, pcts, runs, cols, &rows,
+	    &max_count, &span_us)) == NULL)
+		return;
+	printf("%9s\n", "Slower%");
+	for (row = rows - 1; row >= 0; row--) {
+		printf("%8.1f%%%s", hist_val(row),
+		    row == BUCKETS - 1 ? "+" : " ");
+		for (col = 0; col < cols; col++) {
+			n = cells[row * cols + col];
+			if (n)
+				printf("\033[48;5;%dm \033[0m", ramp[(n - 1) *
+				    nramp / max_count]);
+			else
+				printf(" ");
+		}
+		printf("\n");
+	}
+	printf("%10s0s%*s%.1fs\n", "", cols - 2, "",
+	    (double)span_us / 1000000);
+	printf("%10scount 1 ", "");
+	for (n = 0; n < nramp; n++)
+		printf("\033[48;5;%dm \033[0m", ramp[n]);
+	printf(" %d\n", max_count);
+	free(cells);
+}
+
+int write_heatmap_svg(const char *path, unsigned long long *start_us,
+    double *pcts, int runs, unsigned long long target_us)
+{
+	int cellw = 6, cellh = 12, left = 70, top = 40, bottom = 40;
+	unsigned long long span_us;
+	int *cells, cols, rows, max_count, row, col, n, width, height;
+	double frac;
+	FILE *fp;
+
+	cols = runs < 200 ? runs : 200;
+	if ((cells = heatmap_build(start_us, pcts, runs, cols, &rows,
+	    &max_count, &span_us)) == NULL)
+		return -1;
+	if ((fp = fopen(path, "w")) == NULL) {
+		free(cells);
+		return -1;
+	}
+	width = left + cols * cellw + 20;
+	height = top + rows * cellh + bottom;
+	fprintf(fp, "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+	    "<svg version=\"1.1\" width=\"%d\" height=\"%d\" "
+	    "xmlns=\"http://www.w3.org/2000/svg\" "
+	    "font-family=\"Verdana\" font-size=\"11\">\n", width, height);
+	fprintf(fp, "<rect x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" "
+	    "fill=\"white\"/>\n", width, height);
+	fprintf(fp, "<text x=\"%d\" y=\"20\" text-anchor=\"middle\" "
+	    "font-size=\"15\">p1bench perturbation heatmap, %llu ms runs"
+	    "</text>\n", width / 2, target_us / 1000);
+	for (row = 0; row < rows; row++) {
+		if (row % 5 == 0 || row == rows - 1)
+			fprintf(fp, "<text x=\"%d\" y=\"%d\" "
+			    "text-anchor=\"end\">%.1f%%</text>\n", left - 4,
+			    top + (rows - row) * cellh - 2, hist_val(row));
+		for (col = 0; col < cols; col++) {
+			if ((n = cells[row * cols + col]) == 0)
+				continue;
+			frac = (double)n / max_count;
+			fprintf(fp, "<rect x=\"%d\" y=\"%d\" width=\"%d\" "
+			    "height=\"%d\" fill=\"rgb(%d,%d,%d)\"><title>"
+			    "%.1fs, %.1f%%: %d runs</title></rect>\n",
+			    left + col * cellw, top + (rows - 1 - row) * cellh,
+			    cellw, cellh, 255 - (int)(55 * frac),
+			    230 - (int)(230 * frac), 180 - (int)(180 * frac),
+			    (double)col * span_us / cols / 1000000,
+			    hist_val(row), n);
+		}
+	}
+	fprintf(fp, "<text x=\"%d\" y=\"%d\">0s</text>\n", left,
+	    top + rows * cellh + 16);
+	fprintf(fp, "<text x=\"%d\" y=\"%d\" text-anchor=\"end\">%.1fs</text>\n",
+	    left + cols * cellw, top + rows * cellh + 16,
+	    (double)span_us / 1000000);
+	fprintf(fp, "<text x=\"%d\" y=\"%d\" text-anchor=\"middle\">"
+	    "time (x), slower%% (y), run count (color, max %d)</text>\n",
+	    width / 2, height - 8, max_count);
+	fprintf(fp, "</svg>\n");
+	fclose(fp);
+	free(cells);
+	return 0;
+}
+
+/*
+ * Binary result files (-b, -r). A file is a sequence of records, and each
+ * invocation appends to it: a header record ('H') with the fingerprint and
+ * configuration, then one record per run ('R') of LEB128 varints: start
+ * time as a delta from the previous run (or the header), duration, user
+ * and system time in microseconds, involuntary context switches, and
+ * major faults. Each run record is flushed as it is written, so
+ * continuous runs (count 0) can be stopped at any time. The header is in
+ * host byte order and layout, and its size is checked when read.
+ *
+ * The reader compares runs by rate (iterations per us), as headers may have
+ * different calibrated counts. By default each run's percent slower is
+ * against its own host's fastest run, so in a mixed fleet a slower host or
+ * SKU isn't counted as perturbation; -a compares against the fastest run
+ * of all hosts instead.
+ */
+#define BIN_MAGIC	"P1B1"
+#define BIN_FIELDS	6	// start, duration, usr, sys, ivcs, majflt
+#define BIN_KEEP	(1 << 18)	// continuous runs kept for the report
+
+struct binhdr {
+	char magic[4];
+	uint32_t size;
+	uint64_t start_us;	// epoch time
+	uint64_t target_us;
+	uint64_t iter_count;
+	uint64_t memsize;
+	uint32_t nthreads;
+	uint32_t fixedtime;	// durations are normalized (-T)
+	char mode[32];		// eg, "spin", "mem read", "net tcp"
+	struct fingerprint fp;
+};
+
+struct binrun {
+	unsigned long long start_us;	// epoch time
+	unsigned long long dur_us;
+	double rate;			// iterations per us
+	double pct;			// slower than the reference fastest run
+	int seg;			// header index
+};
+
+struct binset {
+	struct binhdr *hdrs;
+	int *hdr_runs;			// runs in range, per header
+	int nhdrs;
+	struct binrun *runs;
+	int nruns, nalloc;
+};
+
+FILE *g_binfp;
+unsigned long long g_binlast_us;
+
+static void put_varint(FILE *fp, unsigned long long val)
+{
+	do {
+		fputc((val & 0x7f) | (val > 0x7f ? 0x80 : 0), fp);
+		val >>= 7;
+	} while (val);
+}
+
+static int get_varint(FILE *fp, unsigned long long *val)
+{
+	int c, shift = 0;
+
+	*val = 0;
+	do {
+		if ((c = fgetc(fp)) == EOF || shift > 63)
+			return -1;
+		*val |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+int bin_open(const char *path, struct binhdr *hdr)
+{
+	if ((g_binfp = fopen(path, "ab")) == NULL)
+		return -1;
+	memcpy(hdr->magic, BIN_MAGIC, sizeof (hdr->magic));
+	hdr->size = sizeof (*hdr);
+	fputc('H', g_binfp);
+	if (fwrite(hdr, sizeof (*hdr), 1, g_binfp) != 1 ||
+	    fflush(g_binfp) != 0)
+		return -1;
+	g_binlast_us = hdr->start_us;
+	return 0;
+}
+
+/*
+ * Rotates an array of n elements of size bytes so that element first comes
+ * first, for putting a wrapped ring of runs back in order.
+ */
+static int rotate(void *base, int n, size_t size, int first)
+{
+	char *tmp;
+
+	// arrays for options not in use aren't allocated
+	if (!first || base == NULL)
+		return 0;
+	if ((tmp = malloc(first * size)) == NULL)
+		return -1;
+	memcpy(tmp, base, first * size);
+	memmove(base, (char *)base + first * size, (n - first) * size);
+	memcpy((char *)base + (n - first) * size, tmp, first * size);
+	free(tmp);
+	return 0;
+}
+
+// vals are in BIN_FIELDS order, with the start as epoch time
+int bin_write(unsigned long long *vals)
+{
+	int i;
+
+	// the clock may step backwards; keep deltas unsigned
+	if (vals[0] < g_binlast_us)
+		vals[0] = g_binlast_us;
+	fputc('R', g_binfp);
+	put_varint(g_binfp, vals[0] - g_binlast_us);
+	g_binlast_us = vals[0];
+	for (i = 1; i < BIN_FIELDS; i++)
+		put_varint(g_binfp, vals[i]);
+	return fflush(g_binfp);
+}
+
+/*
+ * Appends the runs of a file that started within [from_us, to_us] to set.
+ * A truncated or corrupt tail, such as from a crash mid-write, ends the
+ * file with a warning.
+ */
+int bin_load(const char *path, struct binset *set,
+    unsigned long long from_us, unsigned long long to_us)
+{
+	unsigned long long vals[BIN_FIELDS], last_us = 0;
+	struct binhdr *hdr;
+	struct binrun *run;
+	FILE *fp;
+	void *p;
+	int c, i, seg = -1;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+		return -1;
+	while ((c = fgetc(fp)) != EOF) {
+		if (c == 'H') {
+			if ((p = realloc(set->hdrs, (set->nhdrs + 1) *
+			    sizeof (struct binhdr))) == NULL)
+				goto nomem;
+			set->hdrs = p;
+			if ((p = realloc(set->hdr_runs, (set->nhdrs + 1) *
+			    sizeof (int))) == NULL)
+				goto nomem;
+			set->hdr_runs = p;
+			hdr = &set->hdrs[set->nhdrs];
+			if (fread(hdr, sizeof (*hdr), 1, fp) != 1 ||
+			    memcmp(hdr->magic, BIN_MAGIC, 4) != 0 ||
+			    hdr->size != sizeof (*hdr) || !hdr->iter_count)
+				break;
+			seg = set->nhdrs++;
+			set->hdr_runs[seg] = 0;
+			last_us = hdr->start_us;
+			continue;
+		}
+		if (c != 'R' || seg < 0)
+			break;
+		for (i = 0; i < BIN_FIELDS; i++) {
+			if (get_varint(fp, &vals[i]) != 0)
+				break;
+		}
+		if (i < BIN_FIELDS)
+			break;
+		last_us += vals[0];
+		// a run without a duration has no rate
+		if (last_us < from_us || last_us > to_us || !vals[1])
+			continue;
+		if (set->nruns == set->nalloc) {
+			if ((p = realloc(set->runs, (set->nalloc ?
+			    set->nalloc * 2 : 1024) * sizeof (struct binrun))) ==
+			    NULL)
+				goto nomem;
+			set->runs = p;
+			set->nalloc = set->nalloc ? set->nalloc * 2 : 1024;
+		}
+		run = &set->runs[set->nruns++];
+		run->start_us = last_us;
+		run->dur_us = vals[1];
+		run->rate = (double)set->hdrs[seg].iter_count / vals[1];
+		run->seg = seg;
+		set->hdr_runs[seg]++;
+	}
+	if (c != EOF)
+		printf("WARNING: %s: truncated or corrupt at offset %ld, "
+		    "ignoring the rest\n", path, ftell(fp));
+	fclose(fp);
+	return 0;
+
+nomem:
+	fclose(fp);
+	return -1;
+}
+
+static int binruncmp(const void *p1, const void *p2)
+{
+	const struct binrun *a = p1, *b = p2;
+	return a->start_us < b->start_us ? -1 : a->start_us > b->start_us;
+}
+
+// epoch seconds, or negative for seconds before now, as epoch us
+static unsigned long long when_us(const char *str)
+{
+	long long secs = atoll(str);
+
+	if (secs < 0)
+		secs += time(NULL);
+	return secs * 1000000ULL;
+}
+
+static void print_time(unsigned long long epoch_us)
+{
+	time_t t = epoch_us / 1000000;
+	char buf[32];
+
+	strftime(buf, sizeof (buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%s", buf);
+}
+
+// percentile of sorted percentages, or -1 if too few runs
+static double pctile_of(double *sorted, int runs, int pct)
+{
+	int min_runs = pct <= 50 ? 3 : pct <= 90 ? 10 : 100;
+
+	if (runs < min_runs)
+		return -1;
+	return sorted[runs * pct / 100 - 1];
+}
+
+/*
+ * Rebuilds the perturbation report for runs, which are in start time
+ * order and have their percentages set (bin_pcts()).
+ */
+int bin_report(struct binrun *runs, int nruns, unsigned long long target_us,
+    int heatmap, char *svgfile)
+{
+	unsigned long long *runs_us, *runs_start, total_us = 0;
+	double *runs_pct, *sorted_pct, *rates;
+	int i, pctile;
+
+	if (!nruns) {
+		printf("No runs in range.\n");
+		return 0;
+	}
+	if ((runs_us = malloc(nruns * sizeof (*runs_us))) == NULL ||
+	    (runs_start = malloc(nruns * sizeof (*runs_start))) == NULL ||
+	    (runs_pct = malloc(nruns * sizeof (*runs_pct))) == NULL ||
+	    (sorted_pct = malloc(nruns * sizeof (*sorted_pct))) == NULL ||
+	    (rates = malloc(nruns * sizeof (*rates))) == NULL)
+		return -1;
+	for (i = 0; i < nruns; i++) {
+		runs_us[i] = runs[i].dur_us;
+		runs_start[i] = runs[i].start_us - runs[0].start_us;
+		runs_pct[i] = sorted_pct[i] = runs[i].pct;
+		rates[i] = -runs[i].rate;	// fastest first
+		total_us += runs_us[i];
+	}
+	qsort(runs_us, nruns, sizeof (*runs_us), ullcmp);
+	qsort(sorted_pct, nruns, sizeof (*sorted_pct), doublecmp);
+	qsort(rates, nruns, sizeof (*rates), doublecmp);
+
+	printf("\nPerturbation percent by count for %d runs:\n", nruns);
+	if (print_hist(runs_pct, nruns) < 0)
+		return -1;
+	if (heatmap) {
+		printf("\nPerturbation heatmap over time:\n");
+		print_heatmap(runs_start, runs_pct, nruns);
+	}
+	if (svgfile) {
+		if (write_heatmap_svg(svgfile, runs_start, runs_pct, nruns,
+		    target_us) != 0)
+			printf("ERROR: writing %s: %s\n", svgfile,
+			    strerror(errno));
+		else
+			printf("\nHeatmap written to %s\n", svgfile);
+	}
+
+	printf("\nPercentiles:");
+	if (nruns >= 3)
+		printf(" 50th: %.3f%%", pctile_of(sorted_pct, nruns, 50));
+	if (nruns >= 10)
+		printf(", 90th: %.3f%%", pctile_of(sorted_pct, nruns, 90));
+	if (nruns >= 100)
+		printf(", 99th: %.3f%%", pctile_of(sorted_pct, nruns, 99));
+	if (nruns >= 3)
+		printf(",");
+	printf(" 100th: %.3f%%\n", sorted_pct[nruns - 1]);
+	printf("Fastest: %.3f ms, 50th: %.3f ms, mean: %.3f ms, "
+	    "slowest: %.3f ms\n", (double)runs_us[0] / 1000,
+	    (double)runs_us[nruns > 1 ? nruns * 50 / 100 - 1 : 0] / 1000,
+	    (double)total_us / nruns / 1000,
+	    (double)runs_us[nruns - 1] / 1000);
+	pctile = nruns >= 100 ? 99 : nruns >= 10 ? 90 : 50;
+	if (nruns >= 3) {
+		printf("Score: %.2f M/s (%dth percentile run rate, %.3f%% "
+		    "slower than fastest)\n",
+		    -rates[nruns * pctile / 100 - 1], pctile,
+		    pctile_of(sorted_pct, nruns, pctile));
+	}
+	free(runs_us);
+	free(runs_start);
+	free(runs_pct);
+	free(sorted_pct);
+	free(rates);
+	return 0;
+}
+
+/*
+ * Header fields that -G can group merged results by, or NULL for an
+ * unknown key.
+ */
+const char *bin_key(struct binhdr *hdr, const char *key)
+{
+	if (strcmp(key, "host") == 0)
+		return hdr->fp.host;
+	if (strcmp(key, "cpu") == 0)
+		return hdr->fp.cpu;
+	if (strcmp(key, "microcode") == 0)
+		return hdr->fp.microcode;
+	if (strcmp(key, "kernel") == 0)
+		return hdr->fp.kernel;
+	if (strcmp(key, "governor") == 0)
+		return hdr->fp.governor;
+	if (strcmp(key, "smt") == 0)
+		return hdr->fp.smt;
+	if (strcmp(key, "thp") == 0)
+		return hdr->fp.thp;
+	if (strcmp(key, "mitigations") == 0)
+		return hdr->fp.mitigations;
+	if (strcmp(key, "virt") == 0)
+		return hdr->fp.virt;
+	if (strcmp(key, "product") == 0)
+		return hdr->fp.product;
+	if (strcmp(key, "mode") == 0)
+		return hdr->mode;
+	return NULL;
+}
+
+/*
+ * Sets each run's percent slower than the fastest run (highest rate) of
+ * the headers with the same key, or of all runs for a NULL key.
+ */
+static int bin_pcts(struct binset *set, struct binrun *runs, int nruns,
+    const char *key)
+{
+	double *fast, *best;
+	int i, j;
+
+	if ((fast = calloc(set->nhdrs, sizeof (double))) == NULL ||
+	    (best = calloc(set->nhdrs, sizeof (double))) == NULL)
+		return -1;
+	for (i = 0; i < nruns; i++) {
+		if (runs[i].rate > fast[runs[i].seg])
+			fast[runs[i].seg] = runs[i].rate;
+	}
+	for (i = 0; i < set->nhdrs; i++) {
+		for (j = 0; j < set->nhdrs; j++) {
+			if ((key == NULL || strcmp(bin_key(&set->hdrs[i], key),
+			    bin_key(&set->hdrs[j], key)) == 0) &&
+			    fast[j] > best[i])
+				best[i] = fast[j];
+		}
+	}
+	for (i = 0; i < nruns; i++)
+		runs[i].pct = 100 * (best[runs[i].seg] / runs[i].rate - 1);
+	free(fast);
+	free(best);
+	return 0;
+}
+
+/*
+ * Per-group breakdown of merged results (-G). Percentiles are of the runs'
+ * own percentages (by host), or with cross, relative to the group's own
+ * fastest run. With verbose, each group's report follows.
+ */
+int bin_groups(struct binset *set, const char *key, int cross, int verbose)
+{
+	const char **groups;
+	double *pcts, *rates;
+	struct binrun *sub;
+	int ngroups = 0, g, i, j, n, hosts, pctile;
+
+	if ((groups = malloc(set->nhdrs * sizeof (char *))) == NULL ||
+	    (pcts = malloc(set->nruns * sizeof (*pcts))) == NULL ||
+	    (rates = malloc(set->nruns * sizeof (*rates))) == NULL ||
+	    (sub = malloc(set->nruns * sizeof (*sub))) == NULL)
+		return -1;
+	for (i = 0; i < set->nhdrs; i++) {
+		if (!set->hdr_runs[i])
+			continue;
+		for (g = 0; g < ngroups; g++) {
+			if (strcmp(groups[g], bin_key(&set->hdrs[i], key)) == 0)
+				break;
+		}
+		if (g == ngroups)
+			groups[ngroups++] = bin_key(&set->hdrs[i], key);
+	}
+
+	printf("\nBy %s:\n", key);
+	printf("%-32s %5s %7s %9s %8s %8s %8s %8s %10s\n", "GROUP", "HOSTS",
+	    "RUNS", "FAST(M/s)", "50th%", "90th%", "99th%", "100th%",
+	    "SCORE(M/s)");
+	for (g = 0; g < ngroups; g++) {
+		// count each host at its first header in the group
+		for (i = hosts = 0; i < set->nhdrs; i++) {
+			if (!set->hdr_runs[i] ||
+			    strcmp(bin_key(&set->hdrs[i], key), groups[g]) != 0)
+				continue;
+			for (j = 0; j < i; j++) {
+				if (set->hdr_runs[j] &&
+				    strcmp(bin_key(&set->hdrs[j], key),
+				    groups[g]) == 0 &&
+				    strcmp(set->hdrs[j].fp.host,
+				    set->hdrs[i].fp.host) == 0)
+					break;
+			}
+			if (j == i)
+				hosts++;
+		}
+		for (i = n = 0; i < set->nruns; i++) {
+			if (strcmp(bin_key(&set->hdrs[set->runs[i].seg], key),
+			    groups[g]) == 0)
+				sub[n++] = set->runs[i];
+		}
+		if (cross && bin_pcts(set, sub, n, NULL) != 0)
+			return -1;
+		for (i = 0; i < n; i++) {
+			pcts[i] = sub[i].pct;
+			rates[i] = -sub[i].rate;	// fastest first
+		}
+		qsort(pcts, n, sizeof (*pcts), doublecmp);
+		qsort(rates, n, sizeof (*rates), doublecmp);
+		printf("%-32.32s %5d %7d %9.2f", groups[g], hosts, n,
+		    -rates[0]);
+		for (j = 0; j < 3; j++) {
+			pctile = j == 0 ? 50 : j == 1 ? 90 : 99;
+			if (pctile_of(pcts, n, pctile) < 0)
+				printf(" %8s", "-");
+			else
+				printf(" %8.3f", pctile_of(pcts, n, pctile));
+		}
+		pctile = n >= 100 ? 99 : n >= 10 ? 90 : 50;
+		printf(" %8.3f %10.2f\n", pcts[n - 1],
+		    -rates[n > 1 ? n * pctile / 100 - 1 : 0]);
+		if (verbose) {
+			printf("\n%s %s:", key, groups[g]);
+			if (bin_report(sub, n, set->hdrs[0].target_us, 0,
+			    NULL) != 0)
+				return -1;
+			printf("\n");
+		}
+	}
+	free(groups);
+	free(pcts);
+	free(rates);
+	free(sub);
+	return 0;
+}
+
+/*
+ * Reader (-r): loads and merges result files, lists their headers, and
+ * reports on the runs in the -t range, overall and by -G group. Runs are
+ * relative to their own host's fastest, or with cross (-a), to the fastest
+ * of all.
+ */
+int bin_read(char **files, int nfiles, unsigned long long from_us,
+    unsigned long long to_us, int heatmap, char *svgfile,
+    const char *group, int cross, int verbose)
+{
+	struct binset set;
+	struct binhdr *hdr;
+	int i, mixed = 0;
+
+	memset(&set, 0, sizeof (set));
+	for (i = 0; i < nfiles; i++) {
+		if (bin_load(files[i], &set, from_us, to_us) != 0) {
+			printf("ERROR: reading %s: %s\n", files[i],
+			    strerror(errno));
+			return 1;
+		}
+	}
+	if (!set.nhdrs) {
+		printf("No p1bench results found.\n");
+		return 1;
+	}
+	qsort(set.runs, set.nruns, sizeof (struct binrun), binruncmp);
+
+	printf("%-19s %-16s %-12s %9s %7s\n", "START", "HOST", "MODE",
+	    "TIME(ms)", "RUNS");
+	for (i = 0; i < set.nhdrs; i++) {
+		hdr = &set.hdrs[i];
+		if (!set.hdr_runs[i])
+			continue;
+		print_time(hdr->start_us);
+		printf(" %-16.16s %-12.12s %9.3f %7d%s\n", hdr->fp.host,
+		    hdr->mode, (double)hdr->target_us / 1000, set.hdr_runs[i],
+		    hdr->fixedtime ? " (-T)" : "");
+		if (strcmp(hdr->mode, set.hdrs[0].mode) != 0 ||
+		    hdr->memsize != set.hdrs[0].memsize ||
+		    hdr->nthreads != set.hdrs[0].nthreads)
+			mixed = 1;
+	}
+	if (set.nruns) {
+		printf("From ");
+		print_time(set.runs[0].start_us);
+		printf(" to ");
+		print_time(set.runs[set.nruns - 1].start_us);
+		printf("\n");
+	}
+	if (mixed && (group == NULL || strcmp(group, "mode") != 0))
+		printf("WARNING: results are from different test "
+		    "configurations (try -G mode)\n");
+	if (bin_pcts(&set, set.runs, set.nruns, cross ? NULL : "host") != 0 ||
+	    bin_report(set.runs, set.nruns, set.hdrs[0].target_us, heatmap,
+	    svgfile) != 0)
+		return 1;
+	if (group && set.nruns && bin_groups(&set, group, cross,
+	    verbose) != 0)
+		return 1;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long iter_count, time_us, time_usr_us,
+	    time_sys_us, ivcs, last_us, total_time_us, fastest_time_us,
+	    slowest_time_us;
+	unsigned long long target_us = 100 * 1000;	// default target ms
+	double slower_ms, diff_pct;
+	static struct timeval ts[2];
+	struct rusage u[2];
+	int test_us = 100 * 1000;
+	int test_runs = 5;	// calibration
+	int max_runs = 100;
+	int verbose = 0;
+	int c, i, j, k, runs, all_runs;
+	unsigned long long *runs_us;
+	double *runs_pct, *runs_unfair;
+	double gbps, total_gbps, unfair, slow_us, fast_us;
+	unsigned long long bytes;
+	int shared = 0;
+	int rdt_monitor = 0, rdt_ways = 0, inside = 0;
+	char *rdt_group = "";
+	unsigned long long llc, mbm[2];
+	unsigned long long *runs_llc, *runs_mbm;
+	char *runs_inside;
+	char *memfile = NULL;
+	int memfd = -1, advice = 0;
+	struct stat st;
+	unsigned long long majflt, total_majflt = 0;
+	char *netproto = NULL, *ipcname = NULL;
+	char *uringfile = NULL, *opt;
+	int heatmap = 0;
+	char *svgfile = NULL;
+	unsigned long long *runs_start, loop_start_us = 0;
+	int overhead = 0;
+	unsigned long long floor_ns = 0;
+	int fixedtime = 0, pctile;
+	int checks = 0, isolation = 0;
+	unsigned long long sizes[MATRIX_MAX], durations[MATRIX_MAX];
+	struct memtype *types[MATRIX_MAX] = { &g_memtypes[0] };
+	int nsizes = 1, ntypes = 1, ndurations = 1, interleave = 0;
+	double sweep_pct = 0, power = 0, snap_pct = 0;
+	char *binfile = NULL, *group = NULL, *traceevents = NULL;
+	char *profprefix = NULL;
+	unsigned long long (*runs_vm)[VM_COUNTERS] = NULL, vm[2][VM_COUNTERS];
+	int vmstat = 0, energy = 0;
+	unsigned long long rapl[2][RAPL_ZONES];
+	double (*runs_energy)[4] = NULL;
+	unsigned long long rapl_ns[2];
+	struct binhdr binhdr;
+	unsigned long long vals[BIN_FIELDS];
+	unsigned long long from_us = 0, to_us = ~0ULL;
+	int reader = 0, cross = 0, continuous = 0, nalloc;
+	unsigned long long chunk = 0, iters = 0;
+	unsigned long long (*chunkrun)(unsigned long long) = NULL;
+	unsigned long long memsize;
+	unsigned long long (*run)(unsigned long long) = spinrun;
+	void *(*test)(void *) = spintest;
+
+	// defaults
+	g_stride = 64;
+	g_memsize = 0;
+
+	// options
+	while ((c = getopt(argc, argv,
+	    "aA:b:c:C:D:Ee:f:g:G:HhIi:K:lL:m:n:OpP:q:rRs:St:Tu:U:vVw:xz:")) != -1) {
+		switch (c) {
+		case 'a':
+			cross = 1;
+			break;
+		case 'A':
+			if (strcmp(optarg, "populate") == 0)
+				advice = -1;
+			else if (strcmp(optarg, "random") == 0)
+				advice = MADV_RANDOM;
+			else if (strcmp(optarg, "sequential") == 0)
+				advice = MADV_SEQUENTIAL;
+			else {
+				printf("-A advice must be populate, random, "
+				    "or sequential\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'b':
+			binfile = optarg;
+			break;
+		case 'c':
+			if (sscanf(optarg, "%d,%d", &g_pincpu[0],
+			    &g_pincpu[1]) < 1 || g_pincpu[0] < 0) {
+				printf("-c cpu[,cpu] must be CPU ids\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'D':
+			if ((sweep_pct = atof(optarg)) <= 0) {
+				printf("-D pct must be > 0\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'C':
+			rdt_ways = atoi(optarg);
+			if (rdt_ways < 1) {
+				printf("-C ways must be > 0\n");
+				usage();
+				return 0;
+			}
+			rdt_monitor = 1;
+			break;
+		case 'I':
+			isolation = 1;
+			break;
+		case 'i':
+			ipcname = optarg;
+			if (strcmp(ipcname, "pipe") == 0)
+				g_ipctype = IPC_PIPE;
+#ifdef __linux__
+			else if (strcmp(ipcname, "eventfd") == 0)
+				g_ipctype = IPC_EVENTFD;
+			else if (strcmp(ipcname, "splice") == 0)
+				g_ipctype = IPC_SPLICE;
+#endif
+			else {
+				printf("-i type must be pipe, eventfd, or "
+				    "splice (Linux)\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'K':
+#ifndef __linux__
+			printf("-K requires Linux tracefs\n");
+			return 1;
+#endif
+			traceevents = optarg;
+			break;
+		case 'L':
+#ifndef __linux__
+			printf("-L requires Linux perf_event_open\n");
+			return 1;
+#endif
+			profprefix = optarg;
+			break;
+		case 'l':
+			g_latency = 1;
+			break;
+		case 'm':
+			if ((nsizes = parse_size_list(optarg, sizes)) < 1) {
+				printf("-m takes up to %d sizes: Mbytes, or "
+				    "with a K, M, G or T suffix\n", MATRIX_MAX);
+				usage();
+				return 0;
+			}
+			// a list may include 0 for the CPU spin loop
+			for (i = 0; i < nsizes; i++) {
+				if (sizes[i] > g_memsize)
+					g_memsize = sizes[i];
+			}
+			if (!g_memsize) {
+				printf("-m size must be non-zero\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'n':
+			netproto = optarg;
+			if (strcmp(netproto, "tcp") != 0 &&
+			    strcmp(netproto, "udp") != 0 &&
+			    strcmp(netproto, "unix") != 0) {
+				printf("-n proto must be tcp, udp, or unix\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'O':
+			overhead = 1;
+			break;
+		case 'p':
+			checks = 1;
+			break;
+		case 'P':
+			g_nthreads = atoi(optarg);
+			if (g_nthreads < 1) {
+				printf("-P threads must be > 0\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'q':
+			g_qdepth = atoi(optarg);
+			if (g_qdepth < 1 || g_qdepth > 4096) {
+				printf("-q depth must be 1 to 4096\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'r':
+			reader = 1;
+			break;
+		case 'R':
+			rdt_monitor = 1;
+			break;
+		case 's':
+			g_msgsize = strtoull(optarg, NULL, 0);
+			if (!g_msgsize) {
+				printf("-s bytes must be non-zero\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'S':
+			shared = 1;
+			break;
+		case 'w':
+			for (ntypes = 0, opt = strtok(optarg, ","); opt != NULL;
+			    opt = strtok(NULL, ",")) {
+				if (ntypes == MATRIX_MAX ||
+				    (types[ntypes++] = find_memtype(opt)) ==
+				    NULL) {
+					printf("-w type must be read, write, "
+					    "rmw, stream, or chase\n");
+					usage();
+					return 0;
+				}
+			}
+			g_memtype = types[0];
+			break;
+		case 'x':
+			interleave = 1;
+			break;
+		case 'z':
+			if ((snap_pct = atof(optarg)) <= 0) {
+				printf("-z pct must be > 0\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 't':
+			if ((opt = strchr(optarg, ',')) == NULL) {
+				printf("-t range must be from,to\n");
+				usage();
+				return 0;
+			}
+			*opt++ = '\0';
+			if (*optarg)
+				from_us = when_us(optarg);
+			if (*opt)
+				to_us = when_us(opt) + 999999;
+			break;
+		case 'T':
+			fixedtime = 1;
+			break;
+		case 'u':
+#ifndef HAVE_IO_URING
+			printf("-u requires Linux io_uring\n");
+			return 1;
+#endif
+			uringfile = optarg;
+			break;
+		case 'U':
+			for (opt = strtok(optarg, ","); opt != NULL;
+			    opt = strtok(NULL, ",")) {
+				if (strcmp(opt, "poll") == 0)
+					g_uring_poll = 1;
+				else if (strcmp(opt, "iopoll") == 0)
+					g_uring_iopoll = g_uring_direct = 1;
+				else if (strcmp(opt, "fixed") == 0)
+					g_uring_fixed = 1;
+				else if (strcmp(opt, "direct") == 0)
+					g_uring_direct = 1;
+				else {
+					printf("-U options are poll, iopoll, "
+					    "fixed, direct\n");
+					usage();
+					return 0;
+				}
+			}
+			break;
+		case 'V':
+			vmstat = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'E':
+			energy = 1;
+			break;
+		case 'e':
+			power = atof(optarg);
+			if (power <= 0 || power >= 100) {
+				printf("-e conf must be between 0 and 100\n");
+				usage();
+				return 0;
+			}
+			break;
+		case 'f':
+			memfile = optarg;
+			break;
+		case 'G':
+			if (bin_key(&binhdr, optarg) == NULL) {
+				printf("-G key must be host, cpu, microcode, "
+				    "kernel, governor, smt, thp,\nmitigations, "
+				    "virt, product, or mode\n");
+				usage();
+				return 0;
+			}
+			group = optarg;
+			break;
+		case 'g':
+			svgfile = optarg;
+			break;
+		case 'H':
+			heatmap = 1;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			usage();
+			return 0;
+		}
+	}
+	if (reader) {
+		if (optind >= argc) {
+			printf("-r requires result files\n");
+			usage();
+			return 0;
+		}
+		return bin_read(&argv[optind], argc - optind, from_us, to_us,
+		    heatmap, svgfile, group, cross, verbose);
+	}
+	if (cross) {
+		printf("-a requires -r\n");
+		usage();
+		return 0;
+	}
+	// before -f, which shares its working set between threads itself
+	if (shared && g_nthreads < 2) {
+		printf("-S requires -P\n");
+		usage();
+		return 0;
+	}
+	if (memfile) {
+		if (g_memtype->run != memread) {
+			printf("-f file working sets are read only\n");
+			usage();
+			return 0;
+		}
+		if ((memfd = open(memfile, O_RDONLY)) < 0 ||
+		    fstat(memfd, &st) != 0) {
+			printf("ERROR: can't open %s: %s\n", memfile,
+			    strerror(errno));
+			return 1;
+		}
+		// -m limits how much of the file is used
+		if (!g_memsize || g_memsize > st.st_size)
+			g_memsize = st.st_size;
+		if (!g_memsize) {
+			printf("ERROR: %s is empty\n", memfile);
+			return 1;
+		}
+		shared = 1;
+	} else if (advice) {
+		printf("-A requires -f\n");
+		usage();
+		return 0;
+	}
+	if (!!netproto + !!g_ipctype + !!g_memsize + !!uringfile > 1) {
+		printf("-n, -i, -u and -m are exclusive\n");
+		usage();
+		return 0;
+	}
+	// threads are memory test threads; -n, -i and -u have their own
+	if ((g_nthreads > 1 || shared) && !g_memsize) {
+		printf("-P and -S require -m\n");
+		usage();
+		return 0;
+	}
+	// each thread has its own working set unless shared
+	if (!shared && g_memsize > ULLONG_MAX / g_nthreads) {
+		printf("ERROR: -m size times -P threads is over 64 bits\n");
+		usage();
+		return 0;
+	}
+	if (!g_msgsize)
+		g_msgsize = uringfile ? 4096 : 64;
+	if (g_latency && (!g_memsize || g_memtype->run != memchase ||
+	    g_nthreads > 1)) {
+		printf("-l requires -m and -w chase, without -P\n");
+		usage();
+		return 0;
+	}
+	if (traceevents && (g_pincpu[0] < 0 || g_nthreads > 1)) {
+		printf("-K requires -c cpu, and can't be used with -P\n");
+		usage();
+		return 0;
+	}
+	if (profprefix && g_nthreads > 1) {
+		printf("-L can't be used with -P\n");
+		usage();
+		return 0;
+	}
+	if (fixedtime && g_nthreads > 1) {
+		printf("-T is not supported with -P\n");
+		usage();
+		return 0;
+	}
+	if (uringfile) {
+#ifdef HAVE_IO_URING
+		run = uringrun;
+		test = uringtest;
+#endif
+	} else if (g_ipctype) {
+		run = ipcrun;
+		test = ipctest;
+	} else if (netproto) {
+		run = netrun;
+		test = nettest;
+	} else if (g_memsize) {
+		run = g_nthreads > 1 ? memparrun : memrun;
+		test = g_memtype->test;
+	}
+	argc -= optind;
+	if (argc > 2) {
+		usage();
+		return 0;
+	}
+	if (argc) {
+		if ((ndurations = parse_ull_list(argv[optind], durations,
+		    1000)) < 1) {
+			printf("ERROR: up to %d target ms values\n",
+			    MATRIX_MAX);
+			return 1;
+		}
+		for (i = 0; i < ndurations; i++) {
+			if (!durations[i])
+				target_us = 0;
+		}
+		if (ndurations == 1 || target_us)
+			target_us = durations[0];
+	}
+	if (argc > 1)
+		max_runs = atoll(argv[optind + 1]);
+	if (max_runs <= 0) {
+		if (max_runs < 0 || !binfile) {
+			printf("ERROR: count 0 (continuous) requires -b\n");
+			usage();
+			return 1;
 		}
+		continuous = 1;
+	}
+	if (continuous && (traceevents || profprefix)) {
+		printf("-K and -L can't be combined with count 0 "
+		    "(continuous)\n");
+		usage();
+		return 0;
+	}
+	if (!target_us) {
+		printf("ERROR: target ms must be > 0\n");
+		usage();
+		return 1;
+	}
+	if (ndurations == 1)
+		durations[0] = target_us;
+	if (sweep_pct) {
+		if (ndurations > 1) {
+			printf("ERROR: -D takes one time(ms), the longest "
+			    "duration to sweep\n");
+			return 1;
+		}
+		// 1-2-5 series from 100 us up to target_us
+		for (ndurations = 0, time_us = 100; time_us < target_us &&
+		    ndurations < MATRIX_MAX - 1; ndurations++) {
+			durations[ndurations] = time_us;
+			j = time_us;
+			while (j >= 10)
+				j /= 10;
+			time_us = time_us * (j == 2 ? 5 : 2) / (j == 2 ? 2 : 1);
+		}
+		durations[ndurations++] = target_us;
+	}
+	if (interleave && ndurations == 1 && nsizes == 1 && ntypes == 1) {
+		printf("-x requires lists of times, -m or -w\n");
+		usage();
+		return 0;
+	}
+	if (ndurations > 1 || nsizes > 1 || ntypes > 1) {
+		if (netproto || g_ipctype || uringfile || memfile ||
+		    g_nthreads > 1 || fixedtime || isolation || binfile ||
+		    g_latency || traceevents || snap_pct || profprefix ||
+		    vmstat || energy || verbose || heatmap || svgfile ||
+		    overhead || rdt_monitor || rdt_ways || power) {
+			printf("ERROR: lists of times, -m or -w can't be "
+			    "combined with -n, -i, -u, -f, -P, -T, -I, -b, -l, "
+			    "-K, -L, -V, -E, -z, -v, -H, -g, -O, -R, -C or "
+			    "-e\n");
+			return 1;
+		}
+		if (nsizes == 1 && !g_memsize)
+			sizes[0] = 0;
+		fingerprint(&g_fp);
+		print_fingerprint(&g_fp);
+		if (checks)
+			preflight(g_pincpu[0]);
+		if (g_pincpu[0] >= 0 && pin_cpu(pthread_self(),
+		    g_pincpu[0]) != 0) {
+			printf("ERROR: couldn't pin to CPU %d\n", g_pincpu[0]);
+			return 1;
+		}
+		return matrix_run(durations, ndurations, sizes, nsizes, types,
+		    ntypes, max_runs, interleave, test_us, test_runs,
+		    sweep_pct);
+	}
+
+	// per-run statistics, grown as needed by continuous runs
+	nalloc = continuous ? 1024 : max_runs;
+	if ((runs_us = malloc(nalloc * sizeof (time_us))) == NULL ||
+	    (runs_pct = malloc(nalloc * sizeof (double))) == NULL ||
+	    (runs_unfair = malloc(nalloc * sizeof (double))) == NULL ||
+	    (runs_llc = malloc(nalloc * sizeof (llc))) == NULL ||
+	    (runs_mbm = malloc(nalloc * sizeof (llc))) == NULL ||
+	    (runs_inside = malloc(nalloc)) == NULL ||
+	    (runs_start = malloc(nalloc * sizeof (time_us))) == NULL ||
+	    (vmstat && (runs_vm = malloc(nalloc * sizeof (*runs_vm))) ==
+	    NULL) ||
+	    (energy && (runs_energy = malloc(nalloc *
+	    sizeof (*runs_energy))) == NULL)) {
+		printf("ERROR: can't allocate memory for %d runs\n", nalloc);
+		return 1;
+	}
+
+	fingerprint(&g_fp);
+	print_fingerprint(&g_fp);
+	if (checks)
+		preflight(g_pincpu[0]);
+	if (isolation)
+		return isolation_check(target_us, max_runs, g_pincpu[0]);
+
+	/*
+	 * populate working set
+	 */
+	if (memfile) {
+		/*
+		 * Page cache backed working set. This is not pre-touched
+		 * (unless -A populate), so page cache misses and readahead
+		 * behavior are part of the test.
+		 */
+		printf("Mapping %llu Mbytes of %s...\n",
+		    g_memsize / (1024 * 1024), memfile);
+		g_mem = mmap(NULL, g_memsize, PROT_READ, MAP_SHARED
+#ifdef MAP_POPULATE
+		    | (advice == -1 ? MAP_POPULATE : 0)
+#endif
+		    , memfd, 0);
+		if (g_mem == MAP_FAILED) {
+			printf("ERROR: mmap of %s failed: %s\n", memfile,
+			    strerror(errno));
+			return 1;
+		}
+		// the mapping holds its own reference to the file
+		close(memfd);
+		if (advice > 0 && madvise(g_mem, g_memsize, advice) != 0) {
+			printf("ERROR: madvise failed: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (g_memsize) {
+		memsize = shared ? g_memsize : g_memsize * g_nthreads;
+		printf("Allocating %llu Mbytes...\n",
+		    memsize / (1024 * 1024));
+		if ((g_mem = malloc(memsize)) == NULL) {
+			printf("ERROR allocating -m memory. Exiting.\n");
+			return 1;
+		}
+		if (populate(g_mem, memsize, g_pincpu[0]) != 0)
+			return 1;
+	}
+
+	/*
+	 * Parallel memory threads. Shared threads each walk the whole working
+	 * set, but start at different offsets so they don't walk it in
+	 * lockstep.
+	 */
+	if (g_nthreads > 1) {
+		if ((g_memthreads = calloc(g_nthreads,
+		    sizeof (struct memthread))) == NULL) {
+			printf("ERROR: can't allocate thread state\n");
+			return 1;
+		}
+		for (i = 0; i < g_nthreads; i++) {
+			if (shared) {
+				g_memthreads[i].mem = g_mem;
+				g_memthreads[i].size = g_memsize;
+				g_memthreads[i].start = g_memsize / g_stride *
+				    i / g_nthreads;
+			} else {
+				g_memthreads[i].mem = g_mem + g_memsize * i;
+				g_memthreads[i].size = g_memsize;
+			}
+		}
+	}
+
+	// link pointer chasing working sets (per thread, unless shared)
+	if (g_memsize && g_memtype->init) {
+		if (g_nthreads > 1 && !shared) {
+			for (i = 0; i < g_nthreads; i++)
+				g_memtype->init(g_memthreads[i].mem,
+				    g_memthreads[i].size);
+		} else {
+			g_memtype->init(g_mem, g_memsize);
+		}
+	}
+
+	if (rdt_monitor && rdt_setup(rdt_monitor, rdt_ways) != 0)
+		return 1;
+
+	// threads created from here on, including calibration, inherit this
+	if (g_pincpu[0] >= 0 && pin_cpu(pthread_self(), g_pincpu[0]) != 0) {
+		printf("ERROR: couldn't pin to CPU %d\n", g_pincpu[0]);
+		return 1;
+	}
+
+	if (netproto) {
+		printf("Loopback %s, %llu byte messages...\n", netproto,
+		    g_msgsize);
+		if (net_setup(netproto) != 0)
+			return 1;
+	}
+#ifdef HAVE_IO_URING
+	if (uringfile) {
+		printf("io_uring %s, %llu byte reads, queue depth %u...\n",
+		    uringfile, g_msgsize, g_qdepth);
+		if (uring_setup(uringfile) != 0)
+			return 1;
+	}
+#endif
+	if (g_ipctype) {
+		if (g_ipctype == IPC_EVENTFD)
+			printf("IPC eventfd round trips...\n");
+		else
+			printf("IPC %s, %llu byte messages...\n", ipcname,
+			    g_msgsize);
+		if (ipc_setup() != 0)
+			return 1;
+	}
+
+	if (overhead) {
+		floor_ns = print_overhead();
+		printf("\n");
 	}
 
 	/*
@@ -327,6 +5800,61 @@ int main(int argc, char *argv[])
 	fflush(stdout);
 	iter_count = find_count(target_us, test_us, test_runs, test, run);
 	printf(" (target iteration count: %llu)\n", iter_count);
+	if (fixedtime) {
+		// poll the clock about 1000 times per run
+		chunk = iter_count / 1000 ? iter_count / 1000 : 1;
+		chunkrun = run == memrun ? memrun_cont : run;
+		printf("Fixed-time runs, polling the clock every %llu "
+		    "iterations\n", chunk);
+	}
+	memset(g_iohist, 0, sizeof (g_iohist));
+	g_netlost = 0;
+	memset(g_lathist, 0, sizeof (g_lathist));
+	memset(g_latlin, 0, sizeof (g_latlin));
+	memset(g_batchhist, 0, sizeof (g_batchhist));
+
+	if (binfile) {
+		memset(&binhdr, 0, sizeof (binhdr));
+		gettimeofday(&ts[0], NULL);
+		binhdr.start_us = 1000000ULL * ts[0].tv_sec + ts[0].tv_usec;
+		binhdr.target_us = target_us;
+		binhdr.iter_count = iter_count;
+		binhdr.memsize = g_memsize;
+		binhdr.nthreads = g_nthreads;
+		binhdr.fixedtime = fixedtime;
+		if (netproto)
+			snprintf(binhdr.mode, sizeof (binhdr.mode), "net %s",
+			    netproto);
+		else if (g_ipctype)
+			snprintf(binhdr.mode, sizeof (binhdr.mode), "ipc %s",
+			    ipcname);
+		else if (uringfile)
+			snprintf(binhdr.mode, sizeof (binhdr.mode), "io_uring");
+		else if (g_memsize)
+			snprintf(binhdr.mode, sizeof (binhdr.mode), "%s %s",
+			    memfile ? "file" : "mem", g_memtype->name);
+		else
+			snprintf(binhdr.mode, sizeof (binhdr.mode), "spin");
+		binhdr.fp = g_fp;
+		if (bin_open(binfile, &binhdr) != 0) {
+			printf("ERROR: writing %s: %s\n", binfile,
+			    strerror(errno));
+			return 1;
+		}
+	}
+
+	if (vmstat && (g_vmfd = open("/proc/vmstat", O_RDONLY)) < 0) {
+		printf("ERROR: can't open /proc/vmstat: %s\n", strerror(errno));
+		return 1;
+	}
+	if (energy && rapl_setup() != 0)
+		return 1;
+#ifdef __linux__
+	if (traceevents && trace_setup(traceevents, g_pincpu[0]) != 0)
+		return 1;
+	if (profprefix && prof_setup() != 0)
+		return 1;
+#endif
 
 	signal(SIGINT, mainstop);
 	time_us = 0;
@@ -335,37 +5863,162 @@ int main(int argc, char *argv[])
 	// run loop
 	fastest_time_us = ~0ULL;
 	slowest_time_us = 0;
-	for (i = 0; g_mainrun && i < max_runs; i++) {
+	for (i = 0; g_mainrun && (continuous || i < max_runs); i++) {
 		last_us = time_us;
+		if (i == nalloc && nalloc < BIN_KEEP) {
+			nalloc *= 2;
+			if ((runs_us = realloc(runs_us,
+			    nalloc * sizeof (time_us))) == NULL ||
+			    (runs_pct = realloc(runs_pct,
+			    nalloc * sizeof (double))) == NULL ||
+			    (runs_unfair = realloc(runs_unfair,
+			    nalloc * sizeof (double))) == NULL ||
+			    (runs_llc = realloc(runs_llc,
+			    nalloc * sizeof (llc))) == NULL ||
+			    (runs_mbm = realloc(runs_mbm,
+			    nalloc * sizeof (llc))) == NULL ||
+			    (runs_inside = realloc(runs_inside, nalloc)) == NULL ||
+			    (runs_start = realloc(runs_start,
+			    nalloc * sizeof (time_us))) == NULL ||
+			    (vmstat && (runs_vm = realloc(runs_vm,
+			    nalloc * sizeof (*runs_vm))) == NULL) ||
+			    (energy && (runs_energy = realloc(runs_energy,
+			    nalloc * sizeof (*runs_energy))) == NULL)) {
+				printf("ERROR: can't allocate memory for %d "
+				    "runs\n", nalloc);
+				return 1;
+			}
+		}
+		// past BIN_KEEP, continuous runs replace the oldest kept
+		k = i % nalloc;
+		/*
+		 * alternate runs inside and outside the CAT partition
+		 */
+		if (g_rdt_ctrl[0]) {
+			inside = i % 2;
+			rdt_group = inside ? g_rdt_ctrl : g_rdt_mon;
+			(void) rdt_join(rdt_group);
+		} else {
+			rdt_group = g_rdt_mon;
+		}
+		runs_inside[k] = inside;
+		if (rdt_group[0])
+			(void) rdt_read(rdt_group, &llc, &mbm[0]);
+
 		/*
 		 * spin time, with timeout
 		 */
+		if (snap_pct)
+			snap_before(g_pincpu[0]);
+		if (vmstat)
+			vm_read(vm[0]);
+		if (energy) {
+			rapl_read(rapl[0]);
+			rapl_ns[0] = now_ns();
+		}
+#ifdef __linux__
+		if (traceevents)
+			trace_mark(i, "start");
+		if (profprefix)
+			prof_start();
+#endif
 		getrusage(RUSAGE_SELF, &u[0]);
 		gettimeofday(&ts[0], NULL);
-		(void) run(iter_count);
+		if (fixedtime)
+			iters = timedrun(chunkrun, chunk, target_us);
+		else
+			(void) run(iter_count);
 		gettimeofday(&ts[1], NULL);
 		getrusage(RUSAGE_SELF, &u[1]);
+#ifdef __linux__
+		if (profprefix)
+			prof_stop();
+		if (traceevents)
+			trace_mark(i, "end");
+#endif
+		if (vmstat)
+			vm_read(vm[1]);
+		if (energy) {
+			rapl_read(rapl[1]);
+			rapl_ns[1] = now_ns();
+		}
+		if (rdt_group[0]) {
+			(void) rdt_read(rdt_group, &llc, &mbm[1]);
+			runs_llc[k] = llc;
+			runs_mbm[k] = mbm[1] - mbm[0];
+		}
 
 		/*
 		 * calculate times
 		 */
 		time_us = 1000000 * (ts[1].tv_sec - ts[0].tv_sec) +
 		    (ts[1].tv_usec - ts[0].tv_usec) / 1;
+		/*
+		 * Fixed-time runs are normalized to the time the calibrated
+		 * iteration count would have taken at this run's rate, so the
+		 * stats below are rate perturbation. timedrun() always runs a
+		 * chunk, so a run without iterations means the test failed.
+		 */
+		if (fixedtime && !iters) {
+			printf("\nERROR: fixed-time run %d completed no "
+			    "iterations\n", i + 1);
+			return 1;
+		}
+		if (fixedtime)
+			time_us = time_us * iter_count / iters;
+		if (i == 0)
+			loop_start_us = 1000000ULL * ts[0].tv_sec +
+			    ts[0].tv_usec;
+		runs_start[k] = 1000000ULL * ts[0].tv_sec + ts[0].tv_usec -
+		    loop_start_us;
 		if (time_us < fastest_time_us)
 			fastest_time_us = time_us;
 		if (time_us > slowest_time_us)
 			slowest_time_us = time_us;
-		runs_us[i] = time_us;
+		runs_us[k] = time_us;
+		if (snap_pct && (double)100 * (time_us - fastest_time_us) /
+		    fastest_time_us > snap_pct)
+			snap_after(i, (double)100 * (time_us - fastest_time_us) /
+			    fastest_time_us, g_pincpu[0]);
 		if (last_us)
 			diff_pct = 100 * (((double)time_us / last_us) - 1);
+		majflt = u[1].ru_majflt - u[0].ru_majflt;
+		total_majflt += majflt;
+		if (vmstat) {
+			for (j = 0; j < VM_VMSTAT; j++)
+				runs_vm[k][j] = vm[1][j] - vm[0][j];
+			runs_vm[k][VM_VMSTAT] = u[1].ru_minflt -
+			    u[0].ru_minflt;
+			runs_vm[k][VM_VMSTAT + 1] = majflt;
+		}
+		if (energy) {
+			rapl_joules(rapl[0], rapl[1], runs_energy[k]);
+			// the energy window, which includes the other reads
+			runs_energy[k][RAPL_SECS] = (double)(rapl_ns[1] -
+			    rapl_ns[0]) / 1000000000;
+			runs_energy[k][RAPL_ITERS] = (fixedtime ? iters :
+			    iter_count) * (g_nthreads > 1 ? g_nthreads : 1);
+		}
 
-		// status output
-		if (!verbose) {
-			printf("\rRun %d/%d, Ctrl-C to stop (%.2f%% diff)  ",
-			    i + 1, max_runs, diff_pct);
-			fflush(stdout);
-			continue;
+		// parallel memory stats
+		gbps = unfair = 0;
+		if (g_nthreads > 1) {
+			slow_us = 0;
+			fast_us = ~0ULL;
+			for (j = 0; j < g_nthreads; j++) {
+				if (g_memthreads[j].time_us > slow_us)
+					slow_us = g_memthreads[j].time_us;
+				if (g_memthreads[j].time_us < fast_us)
+					fast_us = g_memthreads[j].time_us;
+				g_memthreads[j].total_us +=
+				    g_memthreads[j].time_us;
+			}
+			if (fast_us)
+				unfair = 100 * ((slow_us / fast_us) - 1);
+			gbps = (double)iter_count * g_stride * g_nthreads /
+			    time_us / 1000;
 		}
+		runs_unfair[k] = unfair;
 
 		// debug stats
 		time_usr_us = 1000000 *
@@ -376,91 +6029,241 @@ int main(int argc, char *argv[])
 		    (u[1].ru_stime.tv_usec - u[0].ru_stime.tv_usec) / 1;
 		ivcs = u[1].ru_nivcsw - u[0].ru_nivcsw;
 
+		if (g_binfp) {
+			vals[0] = 1000000ULL * ts[0].tv_sec + ts[0].tv_usec;
+			vals[1] = time_us;
+			vals[2] = time_usr_us;
+			vals[3] = time_sys_us;
+			vals[4] = ivcs;
+			vals[5] = majflt;
+			if (bin_write(vals) != 0) {
+				printf("ERROR: writing %s: %s\n", binfile,
+				    strerror(errno));
+				return 1;
+			}
+		}
+#ifdef __linux__
+		if (traceevents)
+			trace_drain();
+		if (profprefix)
+			prof_drain(i);
+#endif
+
+		// status output
+		if (!verbose && continuous) {
+			printf("\rRun %d, Ctrl-C to stop (%.2f%% diff)  ",
+			    i + 1, diff_pct);
+			fflush(stdout);
+			continue;
+		} else if (!verbose) {
+			printf("\rRun %d/%d, Ctrl-C to stop (%.2f%% diff)  ",
+			    i + 1, max_runs, diff_pct);
+			fflush(stdout);
+			continue;
+		}
+
 		// verbose output
 		if (i == 0) {
-			printf("%s %s %s %s %s %s\n", "run", "time(ms)",
+			printf("%s %s %s %s %s %s", "run", "time(ms)",
 			    "usr_time(ms)", "sys_time(ms)",
 			    "involuntary_csw", "diff%");
-			printf("%d %.2f %.1f %.1f %llu -\n", i + 1,
-			    (double)time_us / 1000,
-			    (double)time_usr_us / 1000,
-			    (double)time_sys_us / 1000, ivcs);
-		} else {
-			printf("%d %.2f %.1f %.1f %llu %.1f\n", i + 1,
-			    (double)time_us / 1000,
-			    (double)time_usr_us / 1000,
-			    (double)time_sys_us / 1000, ivcs, diff_pct);
+			if (g_nthreads > 1)
+				printf(" %s %s", "GB/s", "unfair%");
+			if (rdt_monitor)
+				printf(" %s %s", "llc(KB)", "mbm(MB)");
+			if (rdt_ways)
+				printf(" %s", "cat");
+			if (memfile && !vmstat)
+				printf(" %s", "majflt");
+			if (netproto || g_ipctype == IPC_EVENTFD)
+				printf(" %s", "rtt(us)");
+			else if (g_ipctype)
+				printf(" %s", "MB/s");
+			if (uringfile)
+				printf(" %s", "IOPS");
+			if (fixedtime)
+				printf(" %s", "iters");
+			for (j = 0; vmstat && j < VM_COUNTERS; j++)
+				printf(" %s", g_vmnames[j]);
+			if (energy)
+				printf(" %s %s", "pkg(J)", "pkg(W)");
+			if (energy && g_nrapl_kind[RAPL_DRAM])
+				printf(" %s", "dram(J)");
+			printf("\n");
+		}
+		printf("%d %.2f %.1f %.1f %llu ", i + 1,
+		    (double)time_us / 1000,
+		    (double)time_usr_us / 1000,
+		    (double)time_sys_us / 1000, ivcs);
+		if (i == 0)
+			printf("-");
+		else
+			printf("%.1f", diff_pct);
+		if (g_nthreads > 1)
+			printf(" %.2f %.1f", gbps, unfair);
+		if (rdt_monitor)
+			printf(" %llu %.1f", runs_llc[k] / 1024,
+			    (double)runs_mbm[k] / (1024 * 1024));
+		if (rdt_ways)
+			printf(" %s", inside ? "in" : "out");
+		if (memfile && !vmstat)
+			printf(" %llu", majflt);
+		if (netproto || g_ipctype == IPC_EVENTFD)
+			printf(" %.2f", (double)time_us / iter_count);
+		else if (g_ipctype)
+			printf(" %.1f", (double)iter_count * g_msgsize /
+			    time_us);
+		if (uringfile)
+			printf(" %llu", iter_count * g_qdepth * 1000000 /
+			    time_us);
+		if (fixedtime)
+			printf(" %llu", iters);
+		for (j = 0; vmstat && j < VM_COUNTERS; j++)
+			printf(" %llu", runs_vm[k][j]);
+		if (energy)
+			printf(" %.4f %.2f", runs_energy[k][RAPL_PKG],
+			    runs_energy[k][RAPL_SECS] > 0 ?
+			    runs_energy[k][RAPL_PKG] /
+			    runs_energy[k][RAPL_SECS] : 0);
+		if (energy && g_nrapl_kind[RAPL_DRAM])
+			printf(" %.4f", runs_energy[k][RAPL_DRAM]);
+		printf("\n");
+	}
+	runs = all_runs = i;
+
+	// continuous runs that wrapped: the last nalloc, oldest first
+	if (runs > nalloc) {
+		k = runs % nalloc;
+		runs = nalloc;
+		if (rotate(runs_us, runs, sizeof (*runs_us), k) != 0 ||
+		    rotate(runs_unfair, runs, sizeof (*runs_unfair), k) != 0 ||
+		    rotate(runs_llc, runs, sizeof (*runs_llc), k) != 0 ||
+		    rotate(runs_mbm, runs, sizeof (*runs_mbm), k) != 0 ||
+		    rotate(runs_inside, runs, sizeof (*runs_inside), k) != 0 ||
+		    rotate(runs_start, runs, sizeof (*runs_start), k) != 0 ||
+		    rotate(runs_vm, runs, sizeof (*runs_vm), k) != 0 ||
+		    rotate(runs_energy, runs, sizeof (*runs_energy), k) != 0) {
+			printf("ERROR: can't allocate memory for %d runs\n",
+			    runs);
+			return 1;
 		}
+		fastest_time_us = ~0ULL;
+		slowest_time_us = 0;
+		for (i = 0; i < runs; i++) {
+			if (runs_us[i] < fastest_time_us)
+				fastest_time_us = runs_us[i];
+			if (runs_us[i] > slowest_time_us)
+				slowest_time_us = runs_us[i];
+		}
+		printf("\nReporting the last %d of %d runs; %s has them all\n",
+		    runs, all_runs, binfile);
 	}
-	runs = i;
 
 	/*
 	 * post-process: histogram and percentiles
 	 */
 	total_time_us = 0;
-	max_idx = 0;
 	for (i = 0; i < runs; i++) {
-		idx = hist_idx(100 *
-		    (((double)runs_us[i] / fastest_time_us) - 1), BUCKETS);
-		if (idx < 0) {
-			// shouldn't happen
-			printf("ERROR: negative hist idx; fix program.\n");
-			return 1;
-		}
-		hist[idx]++;
-		if (idx > max_idx)
-			max_idx = idx;
+		runs_pct[i] = 100 * (((double)runs_us[i] / fastest_time_us) - 1);
 		total_time_us += runs_us[i];
 	}
-	int max_bucket_count = 0;
-	for (i = 0; i <= max_idx; i++) {
-		if (hist[i] > max_bucket_count)
-			max_bucket_count = hist[i];
-	}
 
 	/*
 	 * print histogram and stats
 	 */
 	if (!verbose)
 		printf("\n");
-	printf("\nPerturbation percent by count for %llu ms runs:\n",
-	    target_us / 1000);
-	printf("%9s  %6s %7s %s\n", "Slower%", "Count", "Count%", "Histogram");
-	int bar;
-	double min;
-	for (i = 0; i <= max_idx; i++) {
-		min = hist_val(i);
-		printf("%8.1f%%%s %6d %6.2f%% ", min,
-		    i == BUCKETS - 1 ? "+" : ":", hist[i],
-		    (double)100 * hist[i] / runs);
-		bar = myceil((double)bar_width * hist[i] / max_bucket_count);
-		for (j = 0; j < bar; j++)
-			printf("*");
-		printf("\n");
+	if (fixedtime)
+		printf("\nRate perturbation percent (slower than fastest rate) "
+		    "by count for %llu ms fixed-time runs:\n", target_us / 1000);
+	else
+		printf("\nPerturbation percent by count for %llu ms runs:\n",
+		    target_us / 1000);
+	if (print_hist(runs_pct, runs) < 0)
+		return 1;
+
+	if (heatmap && runs) {
+		printf("\nPerturbation heatmap over time:\n");
+		print_heatmap(runs_start, runs_pct, runs);
+	}
+	if (svgfile && runs) {
+		if (write_heatmap_svg(svgfile, runs_start, runs_pct, runs,
+		    target_us) != 0)
+			printf("ERROR: writing %s: %s\n", svgfile,
+			    strerror(errno));
+		else
+			printf("\nHeatmap written to %s\n", svgfile);
 	}
 
-	qsort(runs_us, runs, sizeof (time_us), ullcmp);
-	printf("\nPercentiles:");
-	if (runs >= 3) {
-		printf(" 50th: %.3f%%", (double)100 *
-		    (runs_us[runs * 50 / 100 - 1] - fastest_time_us) /
-		    fastest_time_us);
+	if (g_nthreads > 1) {
+		printf("\nPer-thread unfairness percent (slowest thread vs "
+		    "fastest thread) by count:\n");
+		if (print_hist(runs_unfair, runs) < 0)
+			return 1;
 	}
-	if (runs >= 10) {
-		printf(", 90th: %.3f%%", (double)100 *
-		    (runs_us[runs * 90 / 100 - 1] - fastest_time_us) /
-		    fastest_time_us);
+
+	if (rdt_monitor && runs) {
+		llc = mbm[0] = 0;
+		for (i = 0; i < runs; i++) {
+			llc += runs_llc[i];
+			mbm[0] += runs_mbm[i];
+		}
+		printf("\nLLC occupancy mean: %llu KB, memory bandwidth (MBM) "
+		    "mean: %.1f MB/s\n", llc / runs / 1024,
+		    (double)mbm[0] / total_time_us * 1000000 / (1024 * 1024));
 	}
-	if (runs >= 100) {
-		printf(", 99th: %.3f%%", (double)100 *
-		    (runs_us[runs * 99 / 100 - 1] - fastest_time_us) /
-		    fastest_time_us);
+
+	if (memfile && runs) {
+		printf("\nMajor faults: total: %llu, mean per run: %.1f\n",
+		    total_majflt, (double)total_majflt / all_runs);
+	}
+
+	/*
+	 * CAT comparison: both sides are relative to the overall fastest run,
+	 * so the histograms and means can be compared directly.
+	 */
+	if (rdt_ways) {
+		for (inside = 1; inside >= 0; inside--) {
+			unsigned long long side_us = 0;
+
+			for (i = j = 0; i < runs; i++) {
+				if (runs_inside[i] != inside)
+					continue;
+				runs_unfair[j++] = runs_pct[i];
+				side_us += runs_us[i];
+			}
+			if (!j)
+				continue;
+			printf("\n%s CAT partition (%d runs, mean %.3f ms), "
+			    "perturbation percent by count:\n",
+			    inside ? "Inside" : "Outside", j,
+			    (double)side_us / j / 1000);
+			if (print_hist(runs_unfair, j) < 0)
+				return 1;
+		}
 	}
-	if (runs >= 3)
-		printf(",");
-	printf(" 100th: %.3f%%\n", (double)100 * 
-	    (runs_us[runs - 1] - fastest_time_us) / fastest_time_us);
 
+#ifdef __linux__
+	if (traceevents && runs)
+		trace_report(runs_us, runs, fastest_time_us);
+	if (profprefix && runs)
+		prof_report(profprefix, runs_us, runs);
+#endif
+	if (snap_pct)
+		print_snapshots(snap_pct, g_pincpu[0]);
+	if (vmstat && runs)
+		print_vmstat(runs_us, runs_vm, runs);
+	if (energy && runs)
+		print_energy(runs_us, runs_energy, runs);
+
+	qsort(runs_us, runs, sizeof (time_us), ullcmp);
+	print_percentiles(runs_us, runs);
+
+	if (overhead) {
+		printf("Measurement floor: %llu ns per run (%.4f%% of "
+		    "fastest), included in run times\n", floor_ns,
+		    (double)floor_ns / fastest_time_us / 10);
+	}
 	printf("Fastest: %.3f ms, 50th: %.3f ms, mean: %.3f ms, "
 	    "slowest: %.3f ms\n",
 	    (double)fastest_time_us / 1000,
@@ -473,6 +6276,86 @@ int main(int argc, char *argv[])
 	    iter_count * 1000000 / runs_us[runs * 50 / 100 - 1],
 	    iter_count * 1000000 / (total_time_us / runs),
 	    iter_count * 1000000 / runs_us[runs - 1]);
-  
+
+	/*
+	 * Normalized score: the rate sustained by all but the slowest runs
+	 * (99th percentile run, or 90th/50th with fewer runs). This combines
+	 * absolute speed and perturbation into one number.
+	 */
+	pctile = runs >= 100 ? 99 : runs >= 10 ? 90 : 50;
+	if (runs >= 3) {
+		printf("Score: %.2f M/s (%dth percentile run rate, %.3f%% "
+		    "slower than fastest)\n",
+		    (double)iter_count / runs_us[runs * pctile / 100 - 1],
+		    pctile, (double)100 *
+		    (runs_us[runs * pctile / 100 - 1] - fastest_time_us) /
+		    fastest_time_us);
+	}
+
+	if (netproto || g_ipctype == IPC_EVENTFD) {
+		printf("Round trip: fastest: %.2f us, 50th: %.2f us, "
+		    "mean: %.2f us, slowest: %.2f us\n",
+		    (double)runs_us[0] / iter_count,
+		    (double)runs_us[runs * 50 / 100 - 1] / iter_count,
+		    (double)total_time_us / runs / iter_count,
+		    (double)runs_us[runs - 1] / iter_count);
+		if (g_netlost)
+			printf("Lost round trips: %llu (no UDP reply within "
+			    "%d ms, included in run times)\n", g_netlost,
+			    NET_TIMEOUT_MS);
+	}
+
+	if (g_ipctype && g_ipctype != IPC_EVENTFD) {
+		bytes = iter_count * g_msgsize;
+		printf("Throughput: fastest: %.1f MB/s, 50th: %.1f MB/s, "
+		    "mean: %.1f MB/s, slowest: %.1f MB/s\n",
+		    (double)bytes / runs_us[0],
+		    (double)bytes / runs_us[runs * 50 / 100 - 1],
+		    (double)bytes / (total_time_us / runs),
+		    (double)bytes / runs_us[runs - 1]);
+	}
+
+	if (uringfile) {
+		bytes = iter_count * g_qdepth * 1000000;
+		printf("IOPS: fastest: %llu, 50th: %llu, mean: %llu, "
+		    "slowest: %llu\n", bytes / runs_us[0],
+		    bytes / runs_us[runs * 50 / 100 - 1],
+		    bytes / (total_time_us / runs), bytes / runs_us[runs - 1]);
+		printf("\nPer-IO latency:\n");
+		print_log2_hist("usecs", g_iohist);
+		printf("\nPer-batch latency:\n");
+		print_log2_hist("usecs", g_batchhist);
+	}
+
+	if (g_latency)
+		print_latency();
+
+	if (g_nthreads > 1) {
+		bytes = iter_count * g_stride * g_nthreads;
+		printf("Aggregate GB/s: fastest: %.2f, 50th: %.2f, mean: %.2f, "
+		    "slowest: %.2f\n",
+		    (double)bytes / runs_us[0] / 1000,
+		    (double)bytes / runs_us[runs * 50 / 100 - 1] / 1000,
+		    (double)bytes / (total_time_us / runs) / 1000,
+		    (double)bytes / runs_us[runs - 1] / 1000);
+		printf("Per-thread GB/s (share%%):");
+		total_gbps = 0;
+		// thread totals are over all runs, not just those kept
+		for (j = 0; j < g_nthreads; j++) {
+			total_gbps += (double)iter_count * g_stride *
+			    all_runs / g_memthreads[j].total_us / 1000;
+		}
+		for (j = 0; j < g_nthreads; j++) {
+			gbps = (double)iter_count * g_stride * all_runs /
+			    g_memthreads[j].total_us / 1000;
+			printf(" %d: %.2f (%.1f%%)", j, gbps,
+			    100 * gbps / total_gbps);
+		}
+		printf("\n");
+	}
+
+	if (power)
+		print_power(runs_us, runs, power);
+
 	return (0);
 }